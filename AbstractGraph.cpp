@@ -99,12 +99,17 @@ void AbstractGraph::paint_square(point position, color c)
 
 void AbstractGraph::paint_image(point position, string filePath)
 {
-    glPushMatrix();
 //    ui->print(filePath);
+    paint_image(position, QPixmap(QString(filePath.c_str())));
+}
+
+/** Draws tex at a third of its size, the same as the label images, centered on position. */
+void AbstractGraph::paint_image(point position, QPixmap tex)
+{
+    glPushMatrix();
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glEnable(GL_BLEND);
     glEnable (GL_TEXTURE_2D);
-    QPixmap tex(QString(filePath.c_str()));
     GLuint textures = bindTexture(tex, GL_TEXTURE_2D);
 //    glGenTextures( 1, &textures );
     glBindTexture(GL_TEXTURE_2D, textures);
@@ -251,6 +256,12 @@ void AbstractGraph::setSequence(const string* seq)
     sequence = seq;
 }
 
+/** Graphs that read the sequence from a worker thread must stop here.  The reader
+  overwrites the same string when a new file is opened. */
+void AbstractGraph::stopBackgroundWork()
+{
+}
+
 int AbstractGraph::width() 
 {
     return ui->getWidth() / ui->getScale();
@@ -2,6 +2,7 @@
 #define ABSTRACT_GRAPH
 
 #include <QGLWidget>
+#include <QPixmap>
 #include <string>
 #include <vector>
 #include "BasicTypes.h"
@@ -52,6 +53,7 @@ public:
     virtual int height();
     virtual void paint_square(point position, color c);
     virtual void paint_image(point position, string filePath);
+    virtual void paint_image(point position, QPixmap tex);
     virtual void paint_line(point startPoint, point endPoint, color c);
     virtual void loadTextureCanvas(bool raggedEdge = false);
     virtual void storeDisplay(vector<color>& pixels, int width, bool raggedEdge = false);
@@ -65,6 +67,7 @@ public:
     virtual void ensureVisible();
     virtual void setButtonFont();
     virtual void setSequence(const string* seq);
+    virtual void stopBackgroundWork();
     virtual string getFileName();
     virtual QScrollArea* settingsUi();
     string reverseComplement(string original);
@@ -85,7 +88,15 @@ public:
         if(a == 'C') return 'G';
         if(a == 'G') return 'C';
         if(a == 'T') return 'A';
-        return a;
+        if(a == 'R') return 'Y';//IUPAC codes complement the set of bases they allow
+        if(a == 'Y') return 'R';
+        if(a == 'K') return 'M';
+        if(a == 'M') return 'K';
+        if(a == 'B') return 'V';
+        if(a == 'V') return 'B';
+        if(a == 'D') return 'H';
+        if(a == 'H') return 'D';
+        return a;//N, S and W are their own complement
     }
 
 public slots:
@@ -0,0 +1,142 @@
+#include "AhoCorasick.h"
+#include "SkittleUtil.h"
+#include <algorithm>
+
+/** ***************************************
+AhoCorasick lets the Sequence Highlighter search a query file with thousands of
+primers in one pass over the view, rather than one pass per primer and another
+for its reverse complement.  The patterns go into a trie over A, C, G and T.
+compile() then adds the failure links breadth first and fills in every missing
+transition, so scanning is one table lookup per nucleotide.  Any other letter in
+the text sends the scan back to the root.  Patterns that contain other letters
+are refused by addPattern().
+*******************************************/
+
+AhoCorasick::AhoCorasick()
+{
+    clear();
+}
+
+void AhoCorasick::clear()
+{
+    nodes.assign(1, Node());
+    for(int c = 0; c < 4; ++c)
+        nodes[0].next[c] = -1;
+    nodes[0].fail = 0;
+    nodes[0].output = -1;
+    lengths.clear();
+    compiled = false;
+}
+
+/** Returns false, and adds nothing, if pattern is empty or has a letter other than ACGT. */
+bool AhoCorasick::addPattern(const string& pattern)
+{
+    if(pattern.empty())
+        return false;
+    for(int i = 0; i < (int)pattern.size(); ++i)
+        if(olig_num(pattern[i]) < 0)
+            return false;
+
+    int state = 0;
+    for(int i = 0; i < (int)pattern.size(); ++i)
+    {
+        int c = olig_num(pattern[i]);
+        if(nodes[state].next[c] < 0)
+        {
+            Node child;
+            for(int k = 0; k < 4; ++k)
+                child.next[k] = -1;
+            child.fail = 0;
+            child.output = -1;
+            nodes[state].next[c] = nodes.size();
+            nodes.push_back(child);
+        }
+        state = nodes[state].next[c];
+    }
+    nodes[state].patterns.push_back(lengths.size());
+    lengths.push_back(pattern.size());
+    compiled = false;
+    return true;
+}
+
+void AhoCorasick::compile()
+{
+    vector<int> queue;
+    for(int c = 0; c < 4; ++c)
+    {
+        int child = nodes[0].next[c];
+        if(child < 0)
+            nodes[0].next[c] = 0;
+        else
+        {
+            nodes[child].fail = 0;
+            queue.push_back(child);
+        }
+    }
+    for(int q = 0; q < (int)queue.size(); ++q)
+    {
+        int state = queue[q];
+        int fail = nodes[state].fail;
+        nodes[state].output = nodes[fail].patterns.empty() ? nodes[fail].output : fail;
+        for(int c = 0; c < 4; ++c)
+        {
+            int child = nodes[state].next[c];
+            if(child < 0)
+                nodes[state].next[c] = nodes[fail].next[c];
+            else
+            {
+                nodes[child].fail = nodes[fail].next[c];
+                queue.push_back(child);
+            }
+        }
+    }
+    compiled = true;
+}
+
+int AhoCorasick::patternCount()
+{
+    return lengths.size();
+}
+
+int AhoCorasick::patternLength(int pattern)
+{
+    return lengths[pattern];
+}
+
+int AhoCorasick::longestPattern()
+{
+    int longest = 0;
+    for(int i = 0; i < (int)lengths.size(); ++i)
+        longest = max(longest, lengths[i]);
+    return longest;
+}
+
+/** Appends every occurrence of every pattern in text to hits, in order of where they end. */
+void AhoCorasick::scan(const char* text, int length, vector<PatternHit>& hits)
+{
+    if(!compiled)
+        compile();
+    int state = 0;
+    for(int j = 0; j < length; ++j)
+    {
+        int c = olig_num(text[j]);
+        if(c < 0)
+        {
+            state = 0;
+            continue;
+        }
+        state = nodes[state].next[c];
+        for(int match = nodes[state].patterns.empty() ? nodes[state].output : state;
+            match >= 0; match = nodes[match].output)
+        {
+            const vector<int>& ending = nodes[match].patterns;
+            for(int k = 0; k < (int)ending.size(); ++k)
+            {
+                PatternHit hit;
+                hit.end = j;
+                hit.pattern = ending[k];
+                hits.push_back(hit);
+            }
+        }
+    }
+}
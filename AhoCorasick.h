@@ -0,0 +1,44 @@
+#ifndef AHO_CORASICK
+#define AHO_CORASICK
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct PatternHit
+{
+    int end;//index in the text of the last nucleotide
+    int pattern;//in the order the patterns were added
+};
+
+/**
+*  Finds every exact occurrence of many ACGT patterns in one pass over a text.
+*/
+class AhoCorasick
+{
+public:
+    AhoCorasick();
+    void clear();
+    bool addPattern(const string& pattern);
+    void compile();
+    int patternCount();
+    int patternLength(int pattern);
+    int longestPattern();
+    void scan(const char* text, int length, vector<PatternHit>& hits);
+
+private:
+    struct Node
+    {
+        int next[4];//after compile(), a full transition table
+        int fail;
+        int output;//next node on the fail chain that ends a pattern, or -1
+        vector<int> patterns;//patterns that end exactly here
+    };
+
+    vector<Node> nodes;
+    vector<int> lengths;
+    bool compiled;
+};
+
+#endif
@@ -187,6 +187,7 @@ void FastaReader::storeChrName(string path)
 {
     string name = trimPathFromFilename(path);
     glWidget->chromosomeName = name;
+    glWidget->sequenceFile = path;
     emit fileNameChanged(name);
 }
 
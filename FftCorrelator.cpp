@@ -0,0 +1,160 @@
+#include "FftCorrelator.h"
+#include <math.h>
+#include <algorithm>
+
+/** ***************************************
+FftCorrelator is a helper for RepeatMap that answers the question "how many
+nucleotides of this line match the sequence k positions further along?" for
+every k in a range with a single transform, instead of one pass over the line
+per offset.
+
+Each sequence is split into four one-hot channels (A, C, G, T).  The number of
+matches at offset k is the sum over the four channels of the cross correlation
+of the reference with the target, which is a product in the frequency domain.
+To save work, two real channels are packed into one complex signal (A + iC and
+G + iT) and separated again after the forward transform.  A line therefore costs
+four forward FFTs and one inverse FFT, O(n log n), no matter how many offsets are
+requested.  N and other unknown characters are all zeros, so they never match.
+
+Buffers and twiddle tables are kept between calls because RepeatMap calls this
+once per line with the same transform size.
+*******************************************/
+
+FftCorrelator::FftCorrelator()
+{
+    fftSize = 0;
+}
+
+/** Smallest power of two that holds a target of length + offsets - 1 without wrap around.*/
+int FftCorrelator::transformSize(int length, int offsets)
+{
+    int needed = length + offsets - 1;
+    int size = 1;
+    while(size < needed)
+        size <<= 1;
+    return size;
+}
+
+/** counts[k] = number of i in [0, length) where reference[i] == target[i + k], for k in [0, offsets).
+target must be readable for length + offsets - 1 characters. */
+void FftCorrelator::matchCounts(const char* reference, int length, const char* target, int offsets, vector<float>& counts)
+{
+    counts.assign(max(0, offsets), 0.0);
+    if(length < 1 || offsets < 1)
+        return;
+
+    prepare(transformSize(length, offsets));
+
+    loadChannels(reference, length, refAC, refGT);
+    loadChannels(target, length + offsets - 1, targetAC, targetGT);
+    transform(refAC, false);
+    transform(refGT, false);
+    transform(targetAC, false);
+    transform(targetGT, false);
+
+    //unpack the four real channels and sum conj(Reference) * Target
+    const complex<double> half(0.5, 0.0);
+    const complex<double> halfI(0.0, -0.5);// 1 / 2i
+    for(int k = 0; k < fftSize; ++k)
+    {
+        int mirror = (fftSize - k) & (fftSize - 1);
+        complex<double> rA = (refAC[k] + conj(refAC[mirror])) * half;
+        complex<double> rC = (refAC[k] - conj(refAC[mirror])) * halfI;
+        complex<double> rG = (refGT[k] + conj(refGT[mirror])) * half;
+        complex<double> rT = (refGT[k] - conj(refGT[mirror])) * halfI;
+        complex<double> tA = (targetAC[k] + conj(targetAC[mirror])) * half;
+        complex<double> tC = (targetAC[k] - conj(targetAC[mirror])) * halfI;
+        complex<double> tG = (targetGT[k] + conj(targetGT[mirror])) * half;
+        complex<double> tT = (targetGT[k] - conj(targetGT[mirror])) * halfI;
+        product[k] = conj(rA) * tA + conj(rC) * tC + conj(rG) * tG + conj(rT) * tT;
+    }
+    transform(product, true);
+
+    for(int k = 0; k < offsets; ++k)
+        counts[k] = floor(product[k].real() + 0.5);//counts are integers, remove rounding noise
+}
+
+void FftCorrelator::prepare(int size)
+{
+    if(size == fftSize)
+        return;
+    fftSize = size;
+
+    int bits = 0;
+    while((1 << bits) < size)
+        ++bits;
+    bitReverse.assign(size, 0);
+    for(int i = 0; i < size; ++i)
+    {
+        int r = 0;
+        for(int b = 0; b < bits; ++b)
+            if(i & (1 << b))
+                r |= 1 << (bits - 1 - b);
+        bitReverse[i] = r;
+    }
+
+    twiddles.resize(max(1, size / 2));
+    for(int i = 0; i < size / 2; ++i)
+    {
+        double angle = -2.0 * M_PI * i / size;
+        twiddles[i] = complex<double>(cos(angle), sin(angle));
+    }
+
+    refAC.resize(size);
+    refGT.resize(size);
+    targetAC.resize(size);
+    targetGT.resize(size);
+    product.resize(size);
+}
+
+/** In place iterative radix-2 FFT.  The inverse includes the 1/N normalization. */
+void FftCorrelator::transform(vector< complex<double> >& data, bool inverse)
+{
+    for(int i = 0; i < fftSize; ++i)
+        if(i < bitReverse[i])
+            swap(data[i], data[bitReverse[i]]);
+
+    for(int span = 2; span <= fftSize; span <<= 1)
+    {
+        int half = span / 2;
+        int stride = fftSize / span;
+        for(int start = 0; start < fftSize; start += span)
+        {
+            for(int j = 0; j < half; ++j)
+            {
+                complex<double> w = twiddles[j * stride];
+                if(inverse)
+                    w = conj(w);
+                complex<double> odd = data[start + j + half] * w;
+                data[start + j + half] = data[start + j] - odd;
+                data[start + j] += odd;
+            }
+        }
+    }
+
+    if(inverse)
+    {
+        double scale = 1.0 / fftSize;
+        for(int i = 0; i < fftSize; ++i)
+            data[i] *= scale;
+    }
+}
+
+void FftCorrelator::loadChannels(const char* seq, int length, vector< complex<double> >& AC, vector< complex<double> >& GT)
+{
+    for(int i = 0; i < fftSize; ++i)
+    {
+        AC[i] = 0.0;
+        GT[i] = 0.0;
+    }
+    for(int i = 0; i < length; ++i)
+    {
+        switch(seq[i])
+        {
+        case 'A': AC[i] = complex<double>(1.0, 0.0); break;
+        case 'C': AC[i] = complex<double>(0.0, 1.0); break;
+        case 'G': GT[i] = complex<double>(1.0, 0.0); break;
+        case 'T': GT[i] = complex<double>(0.0, 1.0); break;
+        }
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef FFT_CORRELATOR
+#define FFT_CORRELATOR
+
+#include <complex>
+#include <vector>
+
+using namespace std;
+
+/**
+*  Computes nucleotide match counts for a whole range of offsets at once by
+*  cross correlating one-hot channels (A, C, G, T) in the frequency domain.
+*/
+class FftCorrelator
+{
+public:
+    FftCorrelator();
+    void matchCounts(const char* reference, int length, const char* target, int offsets, vector<float>& counts);
+    static int transformSize(int length, int offsets);
+
+private:
+    void prepare(int size);
+    void transform(vector< complex<double> >& data, bool inverse);
+    void loadChannels(const char* seq, int length, vector< complex<double> >& AC, vector< complex<double> >& GT);
+
+    int fftSize;
+    vector<int> bitReverse;
+    vector< complex<double> > twiddles;
+    vector< complex<double> > refAC;
+    vector< complex<double> > refGT;
+    vector< complex<double> > targetAC;
+    vector< complex<double> > targetGT;
+    vector< complex<double> > product;
+};
+
+#endif
@@ -0,0 +1,472 @@
+#include "FmIndex.h"
+#include "PackedSequence.h"
+#include "SkittleUtil.h"
+#include <QFile>
+#include <QDataStream>
+#include <algorithm>
+
+/** ***************************************
+FmIndex answers "where does this exact string occur" for the FIND tool and for exact
+highlights, without reading the sequence.  It is the FM-index of Ferragina and Manzini
+("Opportunistic data structures with applications", 2000).
+
+The suffix array of the sequence is built once with SA-IS (Nong, Zhang and Chan, 2009),
+which takes linear time and sorts in place.  The row for each suffix keeps only the
+nucleotide before it, which is the Burrows-Wheeler transform, packed 2 bits per row.
+The terminator, N and other letters are marked in a separate lane mask.  Counts of each
+base are stored every 128 rows, so rank() is a table entry plus at most four popcounts.
+A query is matched backwards one letter at a time, and the rows that are left are
+its matches, so counting costs the same wherever and however often it occurs.
+
+To locate a match, the transform is followed back one position at a time until a row
+whose position was sampled.  Every 32nd position is sampled, and so is every position
+right after an N, so a walk never has to step over a letter that isn't ACGT.
+
+The index is saved as "<sequence file>-skittle_fmindex", with the same size and
+checksum header as the overview pyramid, so each file is only indexed once.
+*******************************************/
+
+static const quint32 indexMagic = 0x534b464d;//"SKFM"
+static const quint32 indexVersion = 1;
+
+/** Sort order of the suffix array: terminator, A, C, G, T, everything else. */
+static inline unsigned char symbol(char c)
+{
+    int base = olig_num(c);
+    return base < 0 ? 5 : base + 1;
+}
+
+//SA-IS.  s[n-1] must be 0 and appear nowhere else; letters are 0 to K.
+template<class T>
+static void getBuckets(const T* s, int n, int K, vector<int>& bucket, bool end)
+{
+    bucket.assign(K + 1, 0);
+    for(int i = 0; i < n; ++i)
+        ++bucket[s[i]];
+    int sum = 0;
+    for(int c = 0; c <= K; ++c)
+    {
+        sum += bucket[c];
+        bucket[c] = end ? sum : sum - bucket[c];
+    }
+}
+
+static inline bool isLMS(const vector<bool>& stype, int i)
+{
+    return i > 0 && stype[i] && !stype[i - 1];
+}
+
+template<class T>
+static void induce(const T* s, int* SA, int n, int K, const vector<bool>& stype, vector<int>& bucket)
+{
+    getBuckets(s, n, K, bucket, false);
+    for(int i = 0; i < n; ++i)
+    {
+        int j = SA[i] - 1;
+        if(j >= 0 && !stype[j])
+            SA[bucket[s[j]]++] = j;
+    }
+    getBuckets(s, n, K, bucket, true);
+    for(int i = n - 1; i >= 0; --i)
+    {
+        int j = SA[i] - 1;
+        if(j >= 0 && stype[j])
+            SA[--bucket[s[j]]] = j;
+    }
+}
+
+/** Returns false if cancelled was set part way through. */
+template<class T>
+static bool suffixArray(const T* s, int* SA, int n, int K, const volatile bool* cancelled)
+{
+    vector<bool> stype(n, false);
+    stype[n - 1] = true;
+    for(int i = n - 3; i >= 0; --i)
+        stype[i] = s[i] < s[i + 1] || (s[i] == s[i + 1] && stype[i + 1]);
+
+    //sort the LMS substrings
+    vector<int> bucket;
+    getBuckets(s, n, K, bucket, true);
+    fill(SA, SA + n, -1);
+    for(int i = 1; i < n; ++i)
+        if(isLMS(stype, i))
+            SA[--bucket[s[i]]] = i;
+    induce(s, SA, n, K, stype, bucket);
+    if(*cancelled)
+        return false;
+
+    //name them, equal substrings get the same name
+    int n1 = 0;
+    for(int i = 0; i < n; ++i)
+        if(isLMS(stype, SA[i]))
+            SA[n1++] = SA[i];
+    fill(SA + n1, SA + n, -1);
+    int names = 0;
+    int previous = -1;
+    for(int i = 0; i < n1; ++i)
+    {
+        int position = SA[i];
+        bool different = false;
+        for(int d = 0; d < n; ++d)
+        {
+            if(previous == -1 || s[position + d] != s[previous + d] || stype[position + d] != stype[previous + d])
+            {
+                different = true;
+                break;
+            }
+            if(d > 0 && (isLMS(stype, position + d) || isLMS(stype, previous + d)))
+                break;
+        }
+        if(different)
+        {
+            ++names;
+            previous = position;
+        }
+        SA[n1 + position / 2] = names - 1;
+    }
+    for(int i = n - 1, j = n - 1; i >= n1; --i)
+        if(SA[i] >= 0)
+            SA[j--] = SA[i];
+
+    //sort the LMS suffixes by recursing on the string of names
+    int* SA1 = SA;
+    int* s1 = SA + n - n1;
+    if(names < n1)
+    {
+        if(!suffixArray((const int*)s1, SA1, n1, names - 1, cancelled))
+            return false;
+    }
+    else
+    {
+        for(int i = 0; i < n1; ++i)
+            SA1[s1[i]] = i;
+    }
+
+    //and induce the rest from them
+    getBuckets(s, n, K, bucket, true);
+    for(int i = 1, j = 0; i < n; ++i)
+        if(isLMS(stype, i))
+            s1[j++] = i;
+    for(int i = 0; i < n1; ++i)
+        SA1[i] = s1[SA1[i]];
+    fill(SA + n1, SA + n, -1);
+    for(int i = n1 - 1; i >= 0; --i)
+    {
+        int j = SA[i];
+        SA[i] = -1;
+        SA[--bucket[s[j]]] = j;
+    }
+    induce(s, SA, n, K, stype, bucket);
+    return !*cancelled;
+}
+
+FmIndex::FmIndex(QObject* parent)
+    :QObject(parent)
+{
+    sequence = NULL;
+    cancelled = false;
+    ready = false;
+    rows = 0;
+    connect(&watcher, SIGNAL(finished()), this, SLOT(buildFinished()));
+}
+
+FmIndex::~FmIndex()
+{
+    cancel();
+}
+
+/** Loads the index from cacheFile, or builds and saves it, on a worker thread, unless
+  that is already running or done for seq.  An empty cacheFile skips the disk. */
+void FmIndex::build(const string* seq, QString cacheFile)
+{
+    if(seq == NULL)
+        return;
+    if(seq == sequence && cacheFile == fileName && (ready || future.isRunning()))
+        return;
+    cancel();
+    sequence = seq;
+    fileName = cacheFile;
+    cancelled = false;
+    future = QtConcurrent::run(this, &FmIndex::buildIndex);
+    watcher.setFuture(future);
+}
+
+/** Blocks until the worker has stopped.  This has to happen before the sequence changes. */
+void FmIndex::cancel()
+{
+    cancelled = true;
+    future.waitForFinished();
+    ready = false;
+    rows = 0;
+    bwt.clear();
+    special.clear();
+    checkpoints.clear();
+    sampledRows.clear();
+    sampledBefore.clear();
+    samples.clear();
+    sequence = NULL;
+}
+
+bool FmIndex::isReady()
+{
+    return ready;
+}
+
+/** Number of exact occurrences of query, or -1 if the index isn't ready or query has a
+  letter other than ACGT. */
+int FmIndex::count(const string& query)
+{
+    quint32 top, bottom;
+    if(!ready || !search(query, top, bottom))
+        return -1;
+    return bottom - top;
+}
+
+/** Every position where query occurs exactly, in ascending order.  Returns false, with
+  no positions, if the index can't answer or there are more than limit of them. */
+bool FmIndex::locate(const string& query, int limit, vector<int>& positions)
+{
+    positions.clear();
+    quint32 top, bottom;
+    if(!ready || !search(query, top, bottom) || bottom - top > (quint32)limit)
+        return false;
+    for(quint32 row = top; row < bottom; ++row)
+    {
+        quint32 r = row;
+        int steps = 0;
+        while(!isSampled(r))
+        {
+            int base = baseAt(r);
+            r = firstRow[base] + rank(base, r);
+            ++steps;
+        }
+        quint32 word = r / 64;
+        quint32 below = popcount64(sampledRows[word] & ((Q_UINT64_C(1) << (r % 64)) - 1));
+        positions.push_back(samples[sampledBefore[word] + below] + steps);
+    }
+    sort(positions.begin(), positions.end());
+    return true;
+}
+
+/** Narrows [top, bottom) to the rows whose suffixes start with query.  Returns false if
+  query is empty or not all ACGT. */
+bool FmIndex::search(const string& query, quint32& top, quint32& bottom)
+{
+    if(query.empty())
+        return false;
+    top = 0;
+    bottom = rows;
+    for(int i = (int)query.size() - 1; i >= 0; --i)
+    {
+        int base = olig_num(query[i]);
+        if(base < 0)
+            return false;
+        if(top < bottom)
+        {
+            top = firstRow[base] + rank(base, top);
+            bottom = firstRow[base] + rank(base, bottom);
+        }
+    }
+    if(top > bottom)
+        bottom = top;
+    return true;
+}
+
+/** How many rows before row have base in the transform. */
+quint32 FmIndex::rank(int base, quint32 row)
+{
+    quint32 block = row / checkpointRows;
+    quint32 total = checkpoints[4 * block + base];
+    quint64 pattern = (quint64)base * PackedSequence::lowBits;
+    quint32 lastWord = row / 32;
+    for(quint32 w = block * (checkpointRows / 32); w <= lastWord; ++w)
+    {
+        quint64 x = bwt[w] ^ pattern;
+        quint64 same = ~(x | (x >> 1)) & ~special[w] & PackedSequence::lowBits;
+        if(w == lastWord)
+            same &= (Q_UINT64_C(1) << (2 * (row % 32))) - 1;
+        total += popcount64(same);
+    }
+    return total;
+}
+
+/** Base before the suffix of row, or -1 for the terminator, N and other letters. */
+int FmIndex::baseAt(quint32 row)
+{
+    int shift = 2 * (row % 32);
+    if((special[row / 32] >> shift) & 1)
+        return -1;
+    return (bwt[row / 32] >> shift) & 3;
+}
+
+bool FmIndex::isSampled(quint32 row)
+{
+    return (sampledRows[row / 64] >> (row % 64)) & 1;
+}
+
+void FmIndex::buildFinished()
+{
+    if(cancelled || sequence == NULL || rows == 0)
+        return;
+    ready = true;
+    emit indexReady();
+}
+
+/** Runs on the worker thread.  Nothing is read until buildFinished() has run. */
+void FmIndex::buildIndex()
+{
+    if(load())
+        return;
+    if(!construct())
+    {
+        rows = 0;
+        return;
+    }
+    save();
+}
+
+bool FmIndex::construct()
+{
+    int n = sequence->size();
+    vector<unsigned char> text(n + 1, 0);//followed by the terminator
+    quint32 counts[6] = {0, 0, 0, 0, 0, 0};
+    for(int i = 0; i < n; ++i)
+    {
+        text[i] = symbol((*sequence)[i]);
+        ++counts[text[i]];
+    }
+    vector<int> suffixes(n + 1);
+    if(!suffixArray(&text[0], &suffixes[0], n + 1, 5, &cancelled))
+        return false;
+
+    rows = n + 1;
+    firstRow[0] = 1;//the terminator's row comes first
+    for(int base = 1; base < 4; ++base)
+        firstRow[base] = firstRow[base - 1] + counts[base];
+    bwt.assign(rows / 32 + 1, 0);
+    special.assign(rows / 32 + 1, 0);
+    checkpoints.assign(4 * (rows / checkpointRows + 1), 0);
+    sampledRows.assign(rows / 64 + 1, 0);
+    samples.clear();
+    quint32 running[4] = {0, 0, 0, 0};
+    for(quint32 row = 0; row < rows; ++row)
+    {
+        if(row % checkpointRows == 0)
+        {
+            if(cancelled)
+                return false;
+            for(int base = 0; base < 4; ++base)
+                checkpoints[4 * (row / checkpointRows) + base] = running[base];
+        }
+        int position = suffixes[row];
+        int before = position == 0 ? 0 : text[position - 1];
+        int shift = 2 * (row % 32);
+        bool known = before >= 1 && before <= 4;
+        if(known)
+        {
+            bwt[row / 32] |= (quint64)(before - 1) << shift;
+            ++running[before - 1];
+        }
+        else
+            special[row / 32] |= Q_UINT64_C(1) << shift;
+        bool walkable = text[position] >= 1 && text[position] <= 4;//only ACGT suffixes are walked to
+        if(position % sampleRate == 0 || (!known && walkable))
+        {
+            sampledRows[row / 64] |= Q_UINT64_C(1) << (row % 64);
+            samples.push_back(position);
+        }
+    }
+    if(rows % checkpointRows == 0)
+        for(int base = 0; base < 4; ++base)
+            checkpoints[4 * (rows / checkpointRows) + base] = running[base];
+
+    sampledBefore.assign(sampledRows.size(), 0);
+    for(int w = 1; w < (int)sampledRows.size(); ++w)
+        sampledBefore[w] = sampledBefore[w - 1] + popcount64(sampledRows[w - 1]);
+    return true;
+}
+
+template<class T>
+static bool readWords(QDataStream& in, vector<T>& words, quint32 expected, const volatile bool* cancelled)
+{
+    quint32 count;
+    in >> count;
+    if(in.status() != QDataStream::Ok || count != expected)
+        return false;
+    words.resize(count);
+    for(quint32 i = 0; i < count; ++i)
+    {
+        if((i & 0xfffff) == 0 && *cancelled)
+            return false;
+        in >> words[i];
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+template<class T>
+static void writeWords(QDataStream& out, const vector<T>& words)
+{
+    out << (quint32)words.size();
+    for(int i = 0; i < (int)words.size(); ++i)
+        out << words[i];
+}
+
+bool FmIndex::load()
+{
+    if(fileName.isEmpty() || !QFile::exists(fileName))
+        return false;
+    QFile file(fileName);
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_4_4);
+
+    quint32 magic, version, rate, checkpoint, size, sum, fileRows;
+    in >> magic >> version >> rate >> checkpoint >> size >> sum >> fileRows;
+    if(magic != indexMagic || version != indexVersion || rate != (quint32)sampleRate
+            || checkpoint != (quint32)checkpointRows || size != sequence->size()
+            || sum != sidecarChecksum(*sequence) || fileRows != size + 1)
+        return false;
+    for(int base = 0; base < 4; ++base)
+        in >> firstRow[base];
+
+    quint32 sampleCount;
+    in >> sampleCount;
+    if(in.status() != QDataStream::Ok || sampleCount > fileRows)
+        return false;
+    if(!readWords(in, bwt, fileRows / 32 + 1, &cancelled)
+            || !readWords(in, special, fileRows / 32 + 1, &cancelled)
+            || !readWords(in, checkpoints, 4 * (fileRows / checkpointRows + 1), &cancelled)
+            || !readWords(in, sampledRows, fileRows / 64 + 1, &cancelled)
+            || !readWords(in, samples, sampleCount, &cancelled))
+        return false;
+
+    sampledBefore.assign(sampledRows.size(), 0);
+    for(int w = 1; w < (int)sampledRows.size(); ++w)
+        sampledBefore[w] = sampledBefore[w - 1] + popcount64(sampledRows[w - 1]);
+    rows = fileRows;
+    return true;
+}
+
+bool FmIndex::save()
+{
+    if(fileName.isEmpty())
+        return false;
+    QFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;//read only directory, it will just be rebuilt next time
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_4_4);
+
+    out << indexMagic << indexVersion << (quint32)sampleRate << (quint32)checkpointRows
+        << (quint32)sequence->size() << sidecarChecksum(*sequence) << rows;
+    for(int base = 0; base < 4; ++base)
+        out << firstRow[base];
+    out << (quint32)samples.size();
+    writeWords(out, bwt);
+    writeWords(out, special);
+    writeWords(out, checkpoints);
+    writeWords(out, sampledRows);
+    writeWords(out, samples);
+    return out.status() == QDataStream::Ok;
+}
@@ -0,0 +1,68 @@
+#ifndef FM_INDEX
+#define FM_INDEX
+
+#include <string>
+#include <vector>
+#include <QObject>
+#include <QString>
+#include <QFuture>
+#include <QFutureWatcher>
+#include <qtconcurrentrun.h>
+
+using namespace std;
+
+/**
+*  A compressed full text index of the whole sequence: its Burrows-Wheeler transform at
+*  2 bits per nucleotide plus a sample of its suffix array.  Counting the exact matches
+*  of a query takes time proportional to the query's length, wherever they are.  Built
+*  once in the background and saved next to the sequence file.
+*/
+class FmIndex : public QObject
+{
+    Q_OBJECT
+
+public:
+    FmIndex(QObject* parent = 0);
+    ~FmIndex();
+    void build(const string* seq, QString cacheFile);
+    void cancel();
+    bool isReady();
+    int count(const string& query);
+    bool locate(const string& query, int limit, vector<int>& positions);
+
+    static const int sampleRate = 32;//every 32nd position of the suffix array is kept
+    static const int checkpointRows = 128;//rows between stored rank counts
+
+signals:
+    void indexReady();
+
+private slots:
+    void buildFinished();
+
+private:
+    void buildIndex();
+    bool construct();
+    bool search(const string& query, quint32& top, quint32& bottom);
+    quint32 rank(int base, quint32 row);
+    int baseAt(quint32 row);
+    bool isSampled(quint32 row);
+    bool load();
+    bool save();
+
+    const string* sequence;
+    QString fileName;
+    volatile bool cancelled;
+    bool ready;
+    quint32 rows;//one per suffix, including the empty one after the terminator
+    quint32 firstRow[4];//first row whose suffix starts with A, C, G, T
+    vector<quint64> bwt;//2 bit codes of the transform, 32 rows per word
+    vector<quint64> special;//lanes of bwt that are the terminator or not ACGT
+    vector<quint32> checkpoints;//count of each base before every checkpointRows rows
+    vector<quint64> sampledRows;//1 bit per row whose position is in samples
+    vector<quint32> sampledBefore;//sampled rows before each word of sampledRows
+    vector<quint32> samples;//sequence position of each sampled row, in row order
+    QFuture<void> future;
+    QFutureWatcher<void> watcher;
+};
+
+#endif
@@ -5,6 +5,7 @@
 #include <sstream>
 #include <algorithm>
 #include <fstream>
+#include <math.h>
 #include <QtGui/QScrollArea>
 #include <QtGui/QSpinBox>
 #include <QtGui/QGridLayout>
@@ -23,12 +24,54 @@ using std::ifstream;
   that each identified sequence doesn't drop below 1 pixel unless it collides with a larger
   search sequence match.
 
-  Development: Unlike NucleotideDisplay and RepeatMap, HighlightDisplay takes up linearly more
-  processing time proportional to the size of the sequence.  It does not have any performance
-  optimization for large sizes.  Adding a BLAST-like performance optimization would make this
-  view more useful for mapping out genome element distributions.  Issue #32
+  Unlike NucleotideDisplay and RepeatMap, HighlightDisplay takes up linearly more processing
+  time proportional to the size of the sequence.  For large views it uses a KmerIndex, built
+  in the background the first time such a view is drawn, to find the few positions where a
+  query could match, and only compares those.  That makes a whole chromosome cost about as
+  much as the number of hits.
+  The grey similarity background is left black in that case; at that zoom it is averaged
+  over so many positions that it reads as noise anyway.  Queries that allow too many
+  mismatches for the index to guarantee every hit still compare at every position.  Issue #32
+
+  With "Allow Insertions/Deletions" checked, calculateWithIndels() scores by edit distance
+  using a MyersMatcher instead, with the same Minimum Similarity threshold.  "Local Alignment"
+  goes further for long consensus queries such as Alu: calculateAligned() scores by
+  Smith-Waterman with affine gaps, run 8 query rows at a time by a StripedAligner.
+
+  Queries are packed 2 bits per nucleotide and scored 32 at a time by a PackedQueryScanner,
+  several queries per pass over the view.  IUPAC codes such as R, Y and N in a query match
+  any of the bases they stand for wherever a query is compared letter by letter, packed or
+  with indels.  The KmerIndex, FmIndex and AhoCorasick only take ACGT queries, so
+  degenerate ones are always compared at every position.  highlightMatches() scores
+  the view a block at a time and keeps only the best pixel so far, not every query's scores.
+
+  From 64bp per pixel up, single hits are too small to see, so each pixel shows how many hits
+  start in it instead.  The hits come from a HitDensityTrack that scans the whole sequence
+  once in the background for the current queries.
+
+  At 100% similarity with 16 or more queries, such as a primer file, all the queries and
+  their reverse complements are compiled into one AhoCorasick automaton, and the view is
+  scanned once instead of twice per query.
+
+  Once a sequence is loaded, an FmIndex of it is built in the background (or read back from
+  its sidecar file).  Exact queries in large views take their hits from it, and findMatch()
+  uses it to jump between the matches of a query for Find Next and Find Previous.
+
+  With "Regular Expressions" checked, each entry is a pattern such as CANNTG or
+  G{3,}N{1,7}G{3,}N{1,7}G{3,}N{1,7}G{3,} rather than a sequence.  Each is compiled into a
+  RegexDfa (with its reverse complement, if that is searched) and the view is scanned once
+  per entry.  Zoomed out, and for Find Next, the hits come from the HitDensityTrack.
 ****************************************/
 
+static const int seededViewSize = 1000000;//smaller views are quick to compare everywhere
+static const int automatonQueryCount = 16;//fewer queries are cheaper one at a time
+static const int queryBatchSize = 16;
+static const int streamBlockSize = 16384;//nucleotides per block, 512KB of scores for a batch
+static const int densityScale = 64;//bp per pixel where hits are counted instead of drawn
+static const int locateLimit = 1000000;//queries with more exact matches aren't listed
+static const int hitCacheLimit = 16000000;//positions kept in exactHits
+static const int findChunkSize = 16384;//nucleotides findExpression() scans at a time
+
 HighlightDisplay::HighlightDisplay(UiVariables* gui, GLWidget* gl)
     :NucleotideDisplay(gui, gl)
 {	
@@ -38,11 +81,20 @@ HighlightDisplay::HighlightDisplay(UiVariables* gui, GLWidget* gl)
     actionData = actionLabel;
     activeSeqEdit = NULL;
     reverseCheck = NULL;
+    indelCheck = NULL;
+    alignCheck = NULL;
+    expressionCheck = NULL;
+    expressionReverse = false;
+    automatonReverse = false;
     formLayout = NULL;
     settingsBox = NULL;
     addButton = NULL;
 
     percentage_match = 0.8;
+    connect(&seeds, SIGNAL(indexReady()), this, SLOT(invalidate()));
+    connect(&density, SIGNAL(trackReady()), this, SLOT(invalidate()));
+    connect(&exactIndex, SIGNAL(indexReady()), this, SLOT(invalidate()));
+    cachedHits = 0;
     frameCount = 0;
     rowCount = 0;
 }
@@ -70,6 +122,13 @@ QScrollArea* HighlightDisplay::settingsUi()
     similarityDial->setMaximum(100);
     reverseCheck = new QCheckBox("Search Reverse Complement", settingsBox);
     reverseCheck->setChecked(true);
+    indelCheck = new QCheckBox("Allow Insertions/Deletions", settingsBox);
+    indelCheck->setToolTip("Score by edit distance, so a query with an indel still matches");
+    alignCheck = new QCheckBox("Local Alignment", settingsBox);
+    alignCheck->setToolTip("Score by Smith-Waterman with affine gaps, for long consensus sequences such as Alu.  "
+                           "Similarity is the identity of a gapless alignment with the same score; unrelated sequence reads about 60%");
+    expressionCheck = new QCheckBox("Regular Expressions", settingsBox);
+    expressionCheck->setToolTip("Read each entry as a pattern over A, C, G, T and IUPAC codes, like GCCN{5}GGC or (CA|TG){10,}");
     QPushButton* OpenFileButton = new QPushButton("Open Query File", settingsBox);
     QPushButton* clearEntriesButton = new QPushButton("Clear All", settingsBox);
     addButton = new QPushButton("Add a New Sequence", settingsBox);
@@ -77,8 +136,11 @@ QScrollArea* HighlightDisplay::settingsUi()
     formLayout->addWidget(reverseCheck, 0,0);
     formLayout->addWidget(OpenFileButton, 0,1);
     formLayout->addWidget(clearEntriesButton, 0,2);
+    formLayout->addWidget(expressionCheck, 0,3);
     formLayout->addWidget(new QLabel("Minimum Similarity:"), 1,0);
     formLayout->addWidget(similarityDial, 1,1);
+    formLayout->addWidget(indelCheck, 1,2);
+    formLayout->addWidget(alignCheck, 1,3);
     formLayout->addWidget(addButton, 2,0);
     addNewSequence();
 
@@ -88,6 +150,9 @@ QScrollArea* HighlightDisplay::settingsUi()
 
     connect( similarityDial, SIGNAL(valueChanged(int)), this, SLOT(setPercentSimilarity(int)));
     connect( reverseCheck, SIGNAL(released()), this, SLOT(invalidate()));
+    connect( indelCheck, SIGNAL(released()), this, SLOT(invalidate()));
+    connect( alignCheck, SIGNAL(released()), this, SLOT(invalidate()));
+    connect( expressionCheck, SIGNAL(released()), this, SLOT(invalidate()));
     return settingsTab;
 }
 
@@ -98,17 +163,29 @@ void HighlightDisplay::display()
     glScaled(1,-1,1);
     if(!upToDate)
     {
-        vector<vector<int> > results;
+        vector<string> queries;
+        vector<int> owners;//seqLines index of each query
         for(int i = 0; i < (int)seqLines.size(); i++)
         {
             if( !seqLines[i]->seq.empty() )
             {
-                results.push_back( identifyMatches( seqLines[i]->seq ) );
+                queries.push_back( seqLines[i]->seq );
+                owners.push_back(i);
                 if(reverseCheck->isChecked())
-                    results.push_back( identifyMatches( reverseComplement(seqLines[i]->seq) ) );
+                {
+                    queries.push_back( reverseComplement(seqLines[i]->seq) );
+                    owners.push_back(i);
+                }
             }
         }
-        combine( results );
+        if(usingDensity(queries, owners))
+            highlightDensity();
+        else if(usingExpressions())
+            highlightExpressions();
+        else if(usingAutomaton())
+            highlightExactMatches();
+        else
+            highlightMatches(queries, owners);
         loadTextureCanvas();
         upToDate = true;
     }
@@ -123,117 +200,648 @@ GLuint HighlightDisplay::render()//deprecated
     return list;
 }
 
-vector<int> HighlightDisplay::identifyMatches(string find)
+/** The value of one pixel for find: grey by similarity, or 260/258 for a matching or
+  mismatching nucleotide of a hit.  scores and seq both start at the pixel's first
+  position, and count is how many of its positions have a score.  trail carries a hit
+  into the pixels after it, so it must see a query's pixels in order. */
+int HighlightDisplay::matchPixel(const string& find, const unsigned short int* scores, int count, const char* seq, MatchTrail& trail)
 {
-    vector<unsigned short int> scores = calculate(find);
-
-    vector<int> pixels;
     int findSize = find.size();
-    int remainingLength = 0;
     int match_minimum = (int)(255 * percentage_match);
-    const char* seq = (sequence->c_str() + ui->getStart(glWidget));//TODO:not a particularly safe way of accessing
-    int offset = 0;
-    int tempScale = ui->getScale();
-    for(int i = 0; i < (int)scores.size(); i+=tempScale)
+    const unsigned short int* bestMatch = max_element(scores, scores + count);
+    short int bestScore = *bestMatch;
+    int grey = static_cast<int>(  float(bestScore)/findSize * 255 );//Grey scale based on similarity
+    int pixelColor = grey;//white to grey
+
+    //highlight matches with color
+    if(grey >= match_minimum)//count this as a starting position
+    {
+        trail.offset = bestMatch - scores;
+        trail.remainingLength = findSize;// - scale;
+    }
+    if(trail.remainingLength >= 1)//trail after a match
+    {//green if it matches, blue if it doesn't
+        char letter = find[findSize - trail.remainingLength];
+        if(seq[trail.offset] == letter || iupacMatches(letter, seq[trail.offset]))
+            pixelColor = 260;//green
+        else
+            pixelColor = 258;//blue
+
+        trail.remainingLength = max(0, trail.remainingLength - ui->getScale());
+    }
+    return pixelColor;
+}
+
+//Matching nucleotides of find at start_h, stopping early once it has too many mismatches.
+static inline unsigned short int matchScore(const string& seq, int start_h, const string& find, unsigned short int maxMismatches)
+{
+    int findSize = find.size();
+    unsigned short int mismatches = 0;
+    unsigned short int l = 0;
+    while(mismatches <= maxMismatches && l < findSize)
+    {
+        if(seq[start_h + l] != find[l] && !iupacMatches(find[l], seq[start_h + l]))//this is the innermost loop.  This line takes the most time
+            ++mismatches;
+        ++l;
+    }
+    return l - mismatches;
+}
+
+unsigned short int HighlightDisplay::allowedMismatches(int findSize)
+{
+    //at 50%   1 = 0,  2 = 1, 3 = 1
+    return findSize - static_cast<unsigned short int>((float)findSize * percentage_match + .999);
+}
+
+/** How well each query in finds matches the view at every nucleotide.  Queries the
+  FmIndex or the seed index can answer use them.  The rest that are all IUPAC codes share
+  one pass of a PackedQueryScanner, which counts every mismatch instead of stopping early, so the grey
+  of non-matches is the similarity of the whole query.  Anything else is compared letter
+  by letter.  Only the count positions from first (relative to the start of the view)
+  are scored. */
+vector< vector<unsigned short int> > HighlightDisplay::calculateAll(const vector<string>& finds, int first, int count)
+{
+    vector< vector<unsigned short int> > scores(finds.size());
+    if(alignCheck != NULL && alignCheck->isChecked())
+    {
+        for(int i = 0; i < (int)finds.size(); ++i)
+            scores[i] = calculateAligned(finds[i], first, count);
+        return scores;
+    }
+    if(indelCheck != NULL && indelCheck->isChecked())
     {
-        vector<unsigned short int>::iterator bestMatch = max_element(scores.begin()+i, scores.begin()+i+tempScale);
-        short int bestScore = *bestMatch;
-        int grey = static_cast<int>(  float(bestScore)/findSize * 255 );//Grey scale based on similarity
-        int pixelColor = grey;//white to grey
+        for(int i = 0; i < (int)finds.size(); ++i)
+            scores[i] = calculateWithIndels(finds[i], first, count);
+        return scores;
+    }
 
-        //highlight matches with color
-        if(grey >= match_minimum)//count this as a starting position
+    PackedQueryScanner batch;
+    vector<int> batched;
+    int longest = 0;
+    for(int i = 0; i < (int)finds.size(); ++i)
+    {
+        if(calculateIndexed(finds[i], first, count, scores[i])
+           || calculateSeeded(finds[i], first, count, scores[i]))
+            continue;
+        if(batch.addQuery(finds[i]))
         {
-            offset = distance(scores.begin()+i, bestMatch);
-            remainingLength = findSize;// - scale;
+            batched.push_back(i);
+            longest = max(longest, (int)finds[i].size());
         }
-        if(remainingLength >= 1)//trail after a match
-        {//green if it matches, blue if it doesn't
-            if(seq[i+offset] == find[findSize - remainingLength])
-                pixelColor = 260;//green
-            else
-                pixelColor = 258;//blue
+        else
+            scores[i] = calculateLetters(finds[i], first, count);
+    }
 
-            remainingLength = max(0, remainingLength - tempScale);
-        }
-        pixels.push_back( pixelColor );
+    if(!batched.empty())
+    {
+        int start = ui->getStart(glWidget) + first;
+        int textLength = max(0, min(count + longest - 1, (int)sequence->size() - start));
+        vector< vector<unsigned short int> > batchScores;
+        batch.scan(sequence->c_str() + start, textLength, count, batchScores);
+        for(int k = 0; k < (int)batched.size(); ++k)
+            scores[batched[k]].swap(batchScores[k]);
+    }
+    return scores;
+}
+
+/** Queries that have to match exactly take their hits in large views straight from the
+  FmIndex.  Returns false if the index can't list them. */
+bool HighlightDisplay::calculateIndexed(const string& find, int first, int count, vector<unsigned short int>& scores)
+{
+    int findSize = find.size();
+    int start = ui->getStart(glWidget) + first;
+    int positions = min(count, (int)sequence->size() - start - (findSize-1));
+    if(current_display_size() < seededViewSize || positions <= 0 || allowedMismatches(findSize) != 0)
+        return false;
+    const vector<int>* hits = exactMatches(find);
+    if(hits == NULL)
+        return false;
+    scores.assign(positions, 0);
+    for(vector<int>::const_iterator it = lower_bound(hits->begin(), hits->end(), start);
+        it != hits->end() && *it < start + positions; ++it)
+        scores[*it - start] = findSize;
+    return true;
+}
+
+/** Sorted start of every exact match of find in the whole sequence, or NULL if the
+  FmIndex isn't ready, find isn't all ACGT or it has too many matches.  The list is
+  kept until the sequence changes, since every frame asks for the same queries. */
+const vector<int>* HighlightDisplay::exactMatches(const string& find)
+{
+    map<string, vector<int> >::iterator known = exactHits.find(find);
+    if(known != exactHits.end())
+        return &known->second;
+    vector<int> hits;
+    if(!exactIndex.locate(find, locateLimit, hits))
+        return NULL;
+    if(cachedHits + (int)hits.size() > hitCacheLimit)
+    {
+        exactHits.clear();
+        cachedHits = 0;
     }
-    return pixels;
+    cachedHits += hits.size();
+    vector<int>& entry = exactHits[find];
+    entry.swap(hits);
+    return &entry;
 }
 
-//This calculates how well a region of the genome matches a query sequence 'find' at every nucleotide.  
-vector<unsigned short int> HighlightDisplay::calculate(string find)
+/** Large views only compare the candidates from the KmerIndex.  Returns false if the
+  index can't be used for find.  The index is only built once a view this large is
+  asked for, since small views never use it. */
+bool HighlightDisplay::calculateSeeded(const string& find, int first, int count, vector<unsigned short int>& scores)
+{
+    int findSize = find.size();
+    int start = ui->getStart(glWidget) + first;
+    const string& seq = *sequence;
+    int positions = min(count, (int)seq.size() - start - (findSize-1));
+    unsigned short int maxMismatches = allowedMismatches(findSize);
+
+    if(current_display_size() < seededViewSize || positions <= 0)
+        return false;
+    seeds.build(sequence);//no-op once it's running or done
+    vector<int> hits;
+    if(!seeds.candidates(find, maxMismatches, start, start + positions - 1, hits))
+        return false;
+    scores.assign(positions, 0);
+    for(int i = 0; i < (int)hits.size(); ++i)
+        scores[hits[i] - start] = matchScore(seq, hits[i], find, maxMismatches);
+    return true;
+}
+
+vector<unsigned short int> HighlightDisplay::calculateLetters(const string& find, int first, int count)
 {
     vector<unsigned short int> scores;
     int findSize = find.size();
+    int start = ui->getStart(glWidget) + first;
+    unsigned short int maxMismatches = allowedMismatches(findSize);
+    const string& seq = *sequence;
+    int positions = min(count, (int)seq.size() - start - (findSize-1));
+    for( int h = 0; h < positions; h++)
+        scores.push_back(matchScore(seq, start + h, find, maxMismatches));
+    return scores;
+}
 
-    int start = ui->getStart(glWidget);
-    unsigned short int maxMismatches = findSize - static_cast<unsigned short int>((float)findSize * percentage_match + .999);
-    //at 50%   1 = 0,  2 = 1, 3 = 1
+/** Same scores as calculateLetters(), but find may have insertions and deletions relative
+  to the sequence.  An alignment is credited to the position findSize-1 before where it
+  ends, so matchPixel() treats it like any other hit.  The text starts a little before
+  the scored range so that alignments near its top edge see their whole length. */
+vector<unsigned short int> HighlightDisplay::calculateWithIndels(const string& find, int first, int count)
+{
+    int findSize = find.size();
+    int start = ui->getStart(glWidget) + first;
+    const string& seq = *sequence;
+    int positions = min(count, (int)seq.size() - start - (findSize-1));
+    vector<unsigned short int> scores(max(0, positions), 0);
+    if(positions <= 0)
+        return scores;
+
+    int textBegin = max(0, start - 2 * findSize);
+    int textEnd = start + positions + findSize - 1;
+    vector<int> distances;
+    MyersMatcher matcher(find);
+    matcher.search(seq.c_str() + textBegin, textEnd - textBegin, distances);
+    for(int j = 0; j < (int)distances.size(); ++j)
+    {
+        int h = textBegin + j - (findSize - 1) - start;
+        if(h >= 0 && h < positions)
+            scores[h] = max(0, findSize - distances[j]);
+    }
+    return scores;
+}
+
+/** Same as calculateWithIndels(), but by Smith-Waterman local alignment score from a
+  StripedAligner.  The score is turned back into the number of matches a full length
+  alignment without gaps would need to get it: with m matches out of findSize the score
+  is m*matchScore - (findSize-m)*mismatchPenalty.  So a copy that is 90% identical reads
+  as 90% on the Minimum Similarity dial, and gaps count about as much as a mismatch or
+  two.  Unrelated sequence still reads around 60%, since a short local alignment scores
+  above zero. */
+vector<unsigned short int> HighlightDisplay::calculateAligned(const string& find, int first, int count)
+{
+    int findSize = find.size();
+    int start = ui->getStart(glWidget) + first;
     const string& seq = *sequence;
-    for( int h = 0; h < current_display_size() && h  < (int)seq.size() - start - (findSize-1); h++)
+    int positions = min(count, (int)seq.size() - start - (findSize-1));
+    vector<unsigned short int> scores(max(0, positions), 0);
+    if(positions <= 0)
+        return scores;
+
+    int textBegin = max(0, start - 2 * findSize);
+    int textEnd = start + positions + findSize - 1;
+    vector<int> alignments;
+    StripedAligner aligner(find);
+    aligner.search(seq.c_str() + textBegin, textEnd - textBegin, alignments);
+    for(int j = 0; j < (int)alignments.size(); ++j)
     {
-        unsigned short int mismatches = 0;
-        int start_h = start + h;
-        unsigned short int l = 0;
-        while(mismatches <= maxMismatches && l < findSize)
+        int h = textBegin + j - (findSize - 1) - start;
+        if(h >= 0 && h < positions && alignments[j] > 0)
+            scores[h] = min(findSize, (alignments[j] + StripedAligner::mismatchPenalty * findSize)
+                            / (StripedAligner::matchScore + StripedAligner::mismatchPenalty));
+    }
+    return scores;
+}
+
+/** Insertions/Deletions and Local Alignment score every position their own way. */
+bool HighlightDisplay::usingGaps()
+{
+    return (indelCheck != NULL && indelCheck->isChecked()) || (alignCheck != NULL && alignCheck->isChecked());
+}
+
+/** Zoomed out, hits are counted from a whole sequence HitDensityTrack.  Starts the
+  track the first time it's needed for these queries; until it is ready the view is
+  scored as usual. */
+bool HighlightDisplay::usingDensity(const vector<string>& queries, const vector<int>& owners)
+{
+    if(ui->getScale() < densityScale)
+        return false;
+    if(usingExpressions())
+        density.scanExpressions(sequence, entryTexts(), reverseCheck->isChecked());
+    else if(usingGaps())
+        return false;
+    else
+        density.scan(sequence, queries, owners, percentage_match);//no-op once it's running or done
+    return density.isReady();
+}
+
+/** Each pixel takes the color of the entry with the most hits in it, brighter on a log
+  scale the more hits there are, so a lone hit is still visible next to a cluster. */
+void HighlightDisplay::highlightDensity()
+{
+    int scale = ui->getScale();
+    int pixels = (current_display_size() + scale - 1) / scale;
+    vector<int> counts;
+    vector<int> winners;
+    density.pixelCounts(ui->getStart(glWidget), scale, pixels, counts, winners);
+    int most = counts.empty() ? 0 : *max_element(counts.begin(), counts.end());
+    double top = log(1.0 + most);
+
+    outputPixels.clear();
+    for(int p = 0; p < pixels; ++p)
+    {
+        if(counts[p] == 0)
         {
-            if(seq[start_h + l] != find[l])//this is the innermost loop.  This line takes the most time
-                ++mismatches;
-            ++l;
+            outputPixels.push_back(color(0,0,0));
+            continue;
         }
-        scores.push_back(l - mismatches);
+        color c = seqLines[winners[p]]->matchColor;
+        double brightness = 0.25 + 0.75 * log(1.0 + counts[p]) / top;
+        outputPixels.push_back(color((int)(c.r * brightness), (int)(c.g * brightness), (int)(c.b * brightness)));
     }
-    return scores;
 }
 
-void HighlightDisplay::combine(vector< vector<int> >& results)
-{	
+/** A query file at 100% similarity is searched in one pass, all queries at once.  The
+  automaton only knows A, C, G and T, so a file with degenerate codes is scored as usual. */
+bool HighlightDisplay::usingAutomaton()
+{
+    if(percentage_match < 1.0 || (int)seqLines.size() < automatonQueryCount
+            || usingGaps())
+        return false;
+    for(int i = 0; i < (int)seqLines.size(); ++i)
+    {
+        const string& query = seqLines[i]->seq;
+        for(int l = 0; l < (int)query.size(); ++l)
+        {
+            int bases = iupacMask(query[l]);
+            if(bases != 0 && bases != 1 && bases != 2 && bases != 4 && bases != 8)
+                return false;
+        }
+    }
+    return true;
+}
+
+/** Only rebuilt when the queries or the reverse complement setting change. */
+void HighlightDisplay::compileAutomaton()
+{
+    vector<string> queries;
+    for(int i = 0; i < (int)seqLines.size(); ++i)
+        queries.push_back(seqLines[i]->seq);
+    bool reverse = reverseCheck->isChecked();
+    if(queries == automatonQueries && reverse == automatonReverse)
+        return;
+
+    automaton.clear();
+    automatonEntries.clear();
+    int skipped = 0;
+    for(int i = 0; i < (int)queries.size(); ++i)
+    {
+        if(queries[i].empty())
+            continue;
+        if(!automaton.addPattern(queries[i]))
+        {
+            ++skipped;
+            continue;
+        }
+        automatonEntries.push_back(i);
+        if(reverse && automaton.addPattern(reverseComplement(queries[i])))
+            automatonEntries.push_back(i);
+    }
+    automaton.compile();
+    automatonQueries = queries;
+    automatonReverse = reverse;
+    if(skipped > 0)
+        ui->print("Queries with letters other than ACGT are not highlighted at 100% similarity: ", skipped);
+}
+
+/** Same pixels highlightMatches() would make for exact matches: each hit colors ceil(length/scale)
+  pixels from the one it starts in, and where hits overlap the earliest entry wins.  The
+  grey similarity background is left black. */
+void HighlightDisplay::highlightExactMatches()
+{
+    compileAutomaton();
+    int start = ui->getStart(glWidget);
+    int scale = ui->getScale();
+    int length = current_display_size();
+    int pixels = (length + scale - 1) / scale;
+    int textLength = min(length + automaton.longestPattern() - 1, (int)sequence->size() - start);
+
+    vector<PatternHit> hits;
+    automaton.scan(sequence->c_str() + start, textLength, hits);
+    vector<int> owner(pixels, -1);
+    for(int i = 0; i < (int)hits.size(); ++i)
+    {
+        int patternLength = automaton.patternLength(hits[i].pattern);
+        int h = hits[i].end - patternLength + 1;
+        if(h < 0 || h >= length)
+            continue;
+        int entry = automatonEntries[hits[i].pattern];
+        int first = h / scale;
+        int last = min(pixels - 1, first + (patternLength + scale - 1) / scale - 1);
+        for(int p = first; p <= last; ++p)
+            if(owner[p] < 0 || entry < owner[p])
+                owner[p] = entry;
+    }
+
     outputPixels.clear();
+    for(int p = 0; p < pixels; ++p)
+    {
+        if(owner[p] < 0)
+            outputPixels.push_back(color(0,0,0));
+        else
+            outputPixels.push_back(seqLines[owner[p]]->matchColor);
+    }
+}
+
+bool HighlightDisplay::usingExpressions()
+{
+    return expressionCheck != NULL && expressionCheck->isChecked();
+}
+
+vector<string> HighlightDisplay::entryTexts()
+{
+    vector<string> texts;
+    for(int i = 0; i < (int)seqLines.size(); ++i)
+        texts.push_back(seqLines[i]->seq);
+    return texts;
+}
+
+/** Only entries that changed are recompiled, so a mistake is reported once. */
+void HighlightDisplay::compileExpressions()
+{
+    vector<string> sources = entryTexts();
+    bool reverse = reverseCheck->isChecked();
+    if(reverse != expressionReverse)
+        expressionSources.clear();
+    expressions.resize(sources.size());
+    expressionSources.resize(sources.size());
+    for(int i = 0; i < (int)sources.size(); ++i)
+    {
+        if(sources[i] == expressionSources[i])
+            continue;
+        string error;
+        expressions[i] = RegexDfa();
+        if(!sources[i].empty() && !expressions[i].compile(sources[i], reverse, error))
+            ui->print("Could not read the expression " + sources[i] + ": " + error);
+        expressionSources[i] = sources[i];
+    }
+    expressionReverse = reverse;
+}
 
-    //ensure they're all the same length
-    int nSequences = results.size();
+/** Same pixels as highlightExactMatches(), except that a hit colors every pixel from its
+  first nucleotide to its last, since matches of one expression differ in length.  The
+  text scanned reaches reach() past both ends of the view, so hits that cross an edge
+  are found whole. */
+void HighlightDisplay::highlightExpressions()
+{
+    compileExpressions();
+    int start = ui->getStart(glWidget);
+    int scale = ui->getScale();
     int length = current_display_size();
-    if(!results.empty())
-        length = results[0].size();
-    vector< vector<int>::iterator > iterators;
-    for(unsigned int i = 0; i < results.size(); ++i)
+    int pixels = (length + scale - 1) / scale;
+
+    vector<int> owner(pixels, -1);
+    vector<MotifHit> hits;
+    for(int e = 0; e < (int)expressions.size(); ++e)
     {
-        if( length != (int)results[i].size() )
+        if(!expressions[e].isCompiled())
+            continue;
+        int reach = expressions[e].reach();
+        int textBegin = max(0, start - reach + 1);
+        int textEnd = min((int)sequence->size(), start + length + reach - 1);
+        hits.clear();
+        expressions[e].scan(sequence->c_str() + textBegin, textEnd - textBegin, hits);
+        for(int i = 0; i < (int)hits.size(); ++i)
         {
-            results[i].resize(length, 0 );
+            int first = max(0, textBegin + hits[i].start - start);
+            int last = min(length - 1, textBegin + hits[i].end - start);
+            if(first > last)
+                continue;
+            for(int p = first / scale; p <= last / scale; ++p)
+                if(owner[p] < 0)
+                    owner[p] = e;
         }
-        iterators.push_back( results[i].begin() );
     }
 
-    color c = color(0,0,0);
-    int matchSeq = 0;
-    for(int i = 0; i < length; i++)
+    outputPixels.clear();
+    for(int p = 0; p < pixels; ++p)
     {
-        int score = 0;
-        for(int k = 0; k < nSequences; ++k)
+        if(owner[p] < 0)
+            outputPixels.push_back(color(0,0,0));
+        else
+            outputPixels.push_back(seqLines[owner[p]]->matchColor);
+    }
+}
+
+/** findMatch() for the last expression.  The HitDensityTrack is used if it already has
+  a list of the hits of these expressions.  Otherwise the sequence is scanned outward from
+  `from` a chunk at a time, stopping at the first chunk with a match, so a nearby match
+  is found quickly however slow the whole sequence would be.  Each chunk's text starts reach()
+  earlier, so matches are reported from the same start as in the view. */
+int HighlightDisplay::findExpression(int from, bool forward)
+{
+    const vector<int>* listed = NULL;
+    if(density.isCurrentExpressions(sequence, entryTexts(), reverseCheck->isChecked()))
+        listed = density.hits(seqLines.size() - 1);//NULL until ready, or if binned
+    if(listed != NULL)
+    {
+        const vector<int>* hits = listed;
+        if(forward)
         {
-            score = max(score, results[k][i]);//*(iterators[k]));
-            //score = *(iterators[k]);
-            //++iterators[k];
-            if(score > 256)
-            {
-                matchSeq = k;
-                if(reverseCheck->isChecked())
-                    matchSeq /= 2;
-                break;
-            }/**/
+            vector<int>::const_iterator next = upper_bound(hits->begin(), hits->end(), from);
+            return next == hits->end() ? -1 : *next;
         }
+        vector<int>::const_iterator next = lower_bound(hits->begin(), hits->end(), from);
+        return next == hits->begin() ? -1 : *(next - 1);
+    }
 
-        if(score < 257)
+    compileExpressions();
+    RegexDfa& dfa = expressions.back();
+    if(!dfa.isCompiled())
+        return -1;
+    int size = sequence->size();
+    int reach = dfa.reach();
+    vector<MotifHit> hits;
+    int next = forward ? from + 1 : from;//edge of the part not yet searched
+    while(forward ? next < size : next > 0)
+    {
+        int chunkBegin = forward ? next : max(0, next - findChunkSize);
+        int chunkEnd = forward ? min(size, next + findChunkSize) : next;
+        next = forward ? chunkEnd : chunkBegin;
+        int textBegin = max(0, chunkBegin - reach);
+        int textEnd = min(size, chunkEnd + reach);
+        hits.clear();
+        dfa.scan(sequence->c_str() + textBegin, textEnd - textBegin, hits);
+        int best = -1;
+        for(int i = 0; i < (int)hits.size(); ++i)
         {
-            c = color(score, score, score);//grey pixel
+            int start = textBegin + hits[i].start;
+            if(start >= chunkBegin && start < chunkEnd && (best < 0 || (forward ? start < best : start > best)))
+                best = start;
         }
-        else{
-            if( score == 258) c = seqLines[matchSeq]->mismatchColor;
-            if( score == 260) c = seqLines[matchSeq]->matchColor;
+        if(best >= 0)
+            return best;
+    }
+    return -1;
+}
+
+/** The FmIndex is started as soon as a sequence is loaded, so that FIND can use it even
+  while the highlighter is hidden.  It carries on if it was already built for seq. */
+void HighlightDisplay::setSequence(const string* seq)
+{
+    seeds.cancel();
+    density.cancel();
+    exactHits.clear();
+    cachedHits = 0;
+    sequence = seq;
+    QString cacheFile;
+    if(!glWidget->sequenceFile.empty())
+        cacheFile = QString(glWidget->sequenceFile.c_str()) + "-skittle_fmindex";
+    exactIndex.build(seq, cacheFile);
+}
+
+void HighlightDisplay::stopBackgroundWork()
+{
+    seeds.cancel();
+    density.cancel();
+    exactIndex.cancel();
+    exactHits.clear();
+    cachedHits = 0;
+}
+
+/** Start of the nearest exact match of the last query after from, or before it if not
+  forward, on either strand if the reverse complement is searched.  -1 if there is
+  none.  Until the FmIndex is ready, or for queries it can't list, the sequence is
+  searched directly. */
+int HighlightDisplay::findMatch(int from, bool forward)
+{
+    if(sequence == NULL || seqLines.empty() || seqLines.back()->seq.empty())
+        return -1;
+    if(usingExpressions())
+        return findExpression(from, forward);
+    vector<string> queries(1, seqLines.back()->seq);
+    if(reverseCheck != NULL && reverseCheck->isChecked())
+        queries.push_back(reverseComplement(queries[0]));
+
+    int best = -1;
+    for(int i = 0; i < (int)queries.size(); ++i)
+    {
+        int hit = -1;
+        const vector<int>* hits = exactMatches(queries[i]);
+        if(hits != NULL)
+        {
+            if(forward)
+            {
+                vector<int>::const_iterator next = upper_bound(hits->begin(), hits->end(), from);
+                if(next != hits->end())
+                    hit = *next;
+            }
+            else
+            {
+                vector<int>::const_iterator next = lower_bound(hits->begin(), hits->end(), from);
+                if(next != hits->begin())
+                    hit = *(next - 1);
+            }
         }
-        outputPixels.push_back( c );
+        else
+        {
+            size_t found = string::npos;
+            if(forward)
+                found = sequence->find(queries[i], from + 1);
+            else if(from > 0)
+                found = sequence->rfind(queries[i], from - 1);
+            if(found != string::npos)
+                hit = found;
+        }
+        if(hit >= 0 && (best < 0 || (forward ? hit < best : hit > best)))
+            best = hit;
+    }
+    return best;
+}
+
+/** Scores the view one block of streamBlockSize nucleotides at a time, and folds every
+  query's pixels into a running maximum as soon as they are made, so only one block of
+  scores per batch of queries is ever held.  As before, the first query to color a pixel
+  green or blue owns it, and otherwise the pixel is the brightest grey of any query. */
+void HighlightDisplay::highlightMatches(const vector<string>& queries, const vector<int>& owners)
+{
+    int start = ui->getStart(glWidget);
+    int scale = ui->getScale();
+    int length = current_display_size();
+    int pixels = (length + scale - 1) / scale;
+    int blockPixels = max(1, streamBlockSize / scale);
+    const char* seq = sequence->c_str() + start;
+    vector<int> best(pixels, 0);//grey, or 258/260 once the pixel has a winner
+    vector<int> winners(pixels, -1);//seqLines index
+    vector<MatchTrail> trails(queries.size());
+
+    for(int firstPixel = 0; firstPixel < pixels; firstPixel += blockPixels)
+    {
+        int endPixel = min(pixels, firstPixel + blockPixels);
+        int first = firstPixel * scale;
+        int count = min(length, endPixel * scale) - first;
+        for(int q = 0; q < (int)queries.size(); q += queryBatchSize)
+        {
+            vector<string> batch(queries.begin() + q, queries.begin() + min((int)queries.size(), q + queryBatchSize));
+            vector< vector<unsigned short int> > scores = calculateAll(batch, first, count);
+            for(int k = 0; k < (int)batch.size(); ++k)
+            {
+                int available = scores[k].size();
+                for(int p = firstPixel; p < endPixel && (p - firstPixel) * scale < available; ++p)
+                {
+                    int i = (p - firstPixel) * scale;
+                    int value = matchPixel(batch[k], &scores[k][i], min(scale, available - i), seq + p * scale, trails[q + k]);
+                    if(winners[p] >= 0)
+                        continue;
+                    if(value > 256)
+                    {
+                        best[p] = value;
+                        winners[p] = owners[q + k];
+                    }
+                    else
+                        best[p] = max(best[p], value);
+                }
+            }
+        }
+    }
+
+    outputPixels.clear();
+    for(int p = 0; p < pixels; ++p)
+    {
+        if(winners[p] < 0)
+            outputPixels.push_back(color(best[p], best[p], best[p]));//grey pixel
+        else if(best[p] == 260)
+            outputPixels.push_back(seqLines[winners[p]]->matchColor);
+        else
+            outputPixels.push_back(seqLines[winners[p]]->mismatchColor);
     }
 }
 
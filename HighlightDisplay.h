@@ -5,8 +5,17 @@
 #include <QGLWidget>
 #include <QString>
 #include "NucleotideDisplay.h"
+#include "KmerIndex.h"
+#include "MyersMatcher.h"
+#include "AhoCorasick.h"
+#include "PackedQueryScanner.h"
+#include "HitDensityTrack.h"
+#include "FmIndex.h"
+#include "StripedAligner.h"
+#include "RegexDfa.h"
 #include <string>
 #include <vector>
+#include <map>
 
 using namespace std;
 class QScrollArea;
@@ -19,14 +28,42 @@ class HighlightDisplay : public NucleotideDisplay
     Q_OBJECT
 
 public:	
+    struct MatchTrail//what is left to draw of a query's last hit
+    {
+        MatchTrail() : remainingLength(0), offset(0) {}
+        int remainingLength;
+        int offset;
+    };
+
     HighlightDisplay(UiVariables* gui, GLWidget* gl);
     ~HighlightDisplay();
     QScrollArea* settingsUi();
     void display();
     GLuint render();
-    vector<int> identifyMatches(string find);
-    vector<unsigned short int> calculate(string find);
-    void combine(vector< vector<int> >& results);
+    int matchPixel(const string& find, const unsigned short int* scores, int count, const char* seq, MatchTrail& trail);
+    vector< vector<unsigned short int> > calculateAll(const vector<string>& finds, int first, int count);
+    bool calculateIndexed(const string& find, int first, int count, vector<unsigned short int>& scores);
+    const vector<int>* exactMatches(const string& find);
+    bool calculateSeeded(const string& find, int first, int count, vector<unsigned short int>& scores);
+    vector<unsigned short int> calculateLetters(const string& find, int first, int count);
+    unsigned short int allowedMismatches(int findSize);
+    vector<unsigned short int> calculateWithIndels(const string& find, int first, int count);
+    vector<unsigned short int> calculateAligned(const string& find, int first, int count);
+    bool usingGaps();
+    void highlightMatches(const vector<string>& queries, const vector<int>& owners);
+    bool usingDensity(const vector<string>& queries, const vector<int>& owners);
+    void highlightDensity();
+    bool usingAutomaton();
+    void compileAutomaton();
+    void highlightExactMatches();
+    bool usingExpressions();
+    vector<string> entryTexts();
+    void compileExpressions();
+    void highlightExpressions();
+    int findExpression(int from, bool forward);
+    void setSequence(const string* seq);
+    void stopBackgroundWork();
+    int findMatch(int from, bool forward);
 
 public slots:
     void setHighlightSequence(const QString&);
@@ -45,10 +82,25 @@ private:
     vector<SequenceEntry*> seqLines;
     double percentage_match;
     QCheckBox* reverseCheck;
+    QCheckBox* indelCheck;
+    QCheckBox* alignCheck;
+    QCheckBox* expressionCheck;
     QLineEdit* activeSeqEdit;
     QGridLayout* formLayout;
     QFrame* settingsBox;
     QPushButton* addButton;
+    KmerIndex seeds;
+    FmIndex exactIndex;
+    map<string, vector<int> > exactHits;//from exactIndex, for queries already asked about
+    int cachedHits;
+    HitDensityTrack density;
+    AhoCorasick automaton;
+    vector<int> automatonEntries;//seqLines index for each pattern in automaton
+    vector<string> automatonQueries;//what automaton was compiled from
+    bool automatonReverse;
+    vector<RegexDfa> expressions;//one per seqLines entry
+    vector<string> expressionSources;//what each of expressions was compiled from
+    bool expressionReverse;
 
 
     /*
@@ -0,0 +1,317 @@
+#include "HitDensityTrack.h"
+#include "PackedQueryScanner.h"
+#include "RegexDfa.h"
+#include <algorithm>
+
+/** ***************************************
+HitDensityTrack is what HighlightDisplay draws once it is zoomed out far enough that
+one pixel covers many possible hits.  The query set (with reverse complements) is run
+over the whole sequence once on a worker thread with PackedQueryScanner, 256kbp at a
+time, and the start of every match is kept in a sorted list per SequenceEntry.  A
+frame then only has to walk the hits inside the view, so zooming out to a whole
+chromosome costs about as much as the number of hits on screen.
+
+A match is the same as in HighlightDisplay::matchPixel(): at least percentage of the
+query's nucleotides agree, IUPAC codes included.  Queries with letters that aren't
+codes are not in the track.
+
+scanExpressions() collects the hits of regular expressions instead, one per entry,
+with a RegexDfa for each.
+
+A short query at a low similarity can match a few percent of all positions, which is
+tens of millions on a chromosome.  Once an entry passes hitLimit, its list is replaced
+by a count of hits per binSize nucleotides, which is all a zoomed out view needs.  Its
+pixels are then counted a bin at a time, so a bin that straddles two pixels counts
+toward the first one.
+*******************************************/
+
+static const int scanBatchSize = 16;//queries per PackedQueryScanner
+
+HitDensityTrack::HitDensityTrack(QObject* parent)
+    :QObject(parent)
+{
+    sequence = NULL;
+    percentage = 0.0;
+    expressions = false;
+    bothStrands = false;
+    cancelled = false;
+    ready = false;
+    connect(&watcher, SIGNAL(finished()), this, SLOT(scanFinished()));
+}
+
+HitDensityTrack::~HitDensityTrack()
+{
+    cancel();
+}
+
+/** Starts a background scan for patterns, unless one is running or done for the same
+  sequence, patterns and similarity.  owners[i] is the entry patterns[i] belongs to. */
+void HitDensityTrack::scan(const string* seq, const vector<string>& patterns, const vector<int>& owners, double similarity)
+{
+    if(seq == NULL)
+        return;
+    if(isCurrent(seq, patterns, owners, similarity) && (ready || future.isRunning()))
+        return;
+    cancel();
+    sequence = seq;
+    queries = patterns;
+    entries = owners;
+    percentage = similarity;
+    expressions = false;
+    cancelled = false;
+    future = QtConcurrent::run(this, &HitDensityTrack::scanSequence);
+    watcher.setFuture(future);
+}
+
+/** Same as scan(), for a regular expression per entry.  Expressions that don't compile
+  have no hits. */
+void HitDensityTrack::scanExpressions(const string* seq, const vector<string>& patterns, bool reverseComplement)
+{
+    if(seq == NULL)
+        return;
+    if(isCurrentExpressions(seq, patterns, reverseComplement) && (ready || future.isRunning()))
+        return;
+    cancel();
+    sequence = seq;
+    queries = patterns;
+    entries.clear();
+    for(int i = 0; i < (int)patterns.size(); ++i)
+        entries.push_back(i);
+    expressions = true;
+    bothStrands = reverseComplement;
+    cancelled = false;
+    future = QtConcurrent::run(this, &HitDensityTrack::scanSequence);
+    watcher.setFuture(future);
+}
+
+/** Blocks until the worker has stopped.  This has to happen before the sequence changes. */
+void HitDensityTrack::cancel()
+{
+    cancelled = true;
+    future.waitForFinished();
+    ready = false;
+    entryHits.clear();
+    entryBins.clear();
+    sequence = NULL;
+}
+
+bool HitDensityTrack::isReady()
+{
+    return ready;
+}
+
+bool HitDensityTrack::isCurrent(const string* seq, const vector<string>& patterns, const vector<int>& owners, double similarity)
+{
+    return seq == sequence && !expressions && patterns == queries && owners == entries && similarity == percentage;
+}
+
+bool HitDensityTrack::isCurrentExpressions(const string* seq, const vector<string>& patterns, bool reverseComplement)
+{
+    return seq == sequence && expressions && patterns == queries && reverseComplement == bothStrands;
+}
+
+/** counts[p] is the number of hits starting in pixel p, which covers
+  [start + p*scale, start + (p+1)*scale).  winners[p] is the entry with the most of them,
+  the earlier entry on ties, or -1. */
+void HitDensityTrack::pixelCounts(int start, int scale, int pixels, vector<int>& counts, vector<int>& winners)
+{
+    counts.assign(max(0, pixels), 0);
+    winners.assign(max(0, pixels), -1);
+    if(!ready || pixels <= 0)
+        return;
+    vector<int> best(pixels, 0);
+    int end = start + pixels * scale;
+    for(int e = 0; e < (int)entryHits.size(); ++e)
+    {
+        int pixel = -1;
+        int run = 0;
+        if(!entryBins[e].empty())
+        {
+            const vector<unsigned char>& bins = entryBins[e];
+            for(int b = start / binSize; b < (int)bins.size() && b * binSize < end; ++b)
+            {
+                if(bins[b] == 0)
+                    continue;
+                int p = (max(start, b * binSize) - start) / scale;
+                countRun(p, bins[b], e, pixel, run, counts, best, winners);
+            }
+        }
+        else
+        {
+            const vector<int>& hits = entryHits[e];
+            for(vector<int>::const_iterator it = lower_bound(hits.begin(), hits.end(), start);
+                it != hits.end() && *it < end; ++it)
+                countRun((*it - start) / scale, 1, e, pixel, run, counts, best, winners);
+        }
+        if(pixel >= 0 && run > best[pixel])
+        {
+            best[pixel] = run;
+            winners[pixel] = e;
+        }
+    }
+}
+
+/** Adds hits to pixel p for entry e.  run is e's count in the current pixel, which is
+  compared against the best so far once the pixels move on. */
+void HitDensityTrack::countRun(int p, int hits, int e, int& pixel, int& run, vector<int>& counts, vector<int>& best, vector<int>& winners)
+{
+    if(p != pixel)
+    {
+        if(pixel >= 0 && run > best[pixel])
+        {
+            best[pixel] = run;
+            winners[pixel] = e;
+        }
+        pixel = p;
+        run = 0;
+    }
+    run += hits;
+    counts[p] += hits;
+}
+
+/** Adds one chunk's hits to an entry's list, or to its bins once the list would pass
+  hitLimit.  Chunks have to come in order and not share any positions. */
+void HitDensityTrack::keepHits(vector<int>& found, vector<int>& list, vector<unsigned char>& bins)
+{
+    sort(found.begin(), found.end());
+    found.erase(unique(found.begin(), found.end()), found.end());
+    if(bins.empty() && (int)(list.size() + found.size()) <= hitLimit)
+    {
+        list.insert(list.end(), found.begin(), found.end());
+        found.clear();
+        return;
+    }
+    if(bins.empty())
+    {
+        bins.assign(sequence->size() / binSize + 1, 0);
+        for(int i = 0; i < (int)list.size(); ++i)
+            ++bins[list[i] / binSize];
+        vector<int>().swap(list);
+    }
+    for(int i = 0; i < (int)found.size(); ++i)
+        ++bins[found[i] / binSize];
+    found.clear();
+}
+
+/** Sorted start positions of entry's hits, or NULL until the track is ready or if
+  there were too many to list. */
+const vector<int>* HitDensityTrack::hits(int entry)
+{
+    if(!ready || entry < 0 || entry >= (int)entryHits.size() || !entryBins[entry].empty())
+        return NULL;
+    return &entryHits[entry];
+}
+
+void HitDensityTrack::scanFinished()
+{
+    if(cancelled || sequence == NULL)
+        return;
+    ready = true;
+    emit trackReady();
+}
+
+/** Runs on the worker thread.  entryHits is only read once scanFinished() has run. */
+void HitDensityTrack::scanSequence()
+{
+    if(expressions)
+    {
+        vector< vector<int> > hits(queries.size());
+        vector< vector<unsigned char> > bins(queries.size());
+        scanForExpressions(hits, bins);
+        if(!cancelled)
+        {
+            entryHits.swap(hits);
+            entryBins.swap(bins);
+        }
+        return;
+    }
+    const string& seq = *sequence;
+    int size = seq.size();
+    int entryCount = 0;
+    for(int i = 0; i < (int)entries.size(); ++i)
+        entryCount = max(entryCount, entries[i] + 1);
+    int match_minimum = (int)(255 * percentage);
+
+    vector<PackedQueryScanner> batches;
+    vector< vector<int> > members;//queries index of each query in each batch
+    int longest = 0;
+    for(int q = 0; q < (int)queries.size(); ++q)
+    {
+        if(batches.empty() || batches.back().queryCount() == scanBatchSize)
+        {
+            batches.push_back(PackedQueryScanner());
+            members.push_back(vector<int>());
+        }
+        if(batches.back().addQuery(queries[q]))
+        {
+            members.back().push_back(q);
+            longest = max(longest, (int)queries[q].size());
+        }
+    }
+
+    vector< vector<int> > hits(entryCount);
+    vector< vector<unsigned char> > bins(entryCount);
+    vector< vector<int> > found(entryCount);//this chunk's hits
+    vector< vector<unsigned short int> > scores;
+    for(int chunk = 0; chunk < size; chunk += chunkSize)
+    {
+        int length = min(chunkSize + longest - 1, size - chunk);
+        for(int b = 0; b < (int)batches.size(); ++b)
+        {
+            if(cancelled)
+                return;
+            batches[b].scan(seq.c_str() + chunk, length, chunkSize, scores);
+            for(int k = 0; k < (int)scores.size(); ++k)
+            {
+                int q = members[b][k];
+                int findSize = queries[q].size();
+                vector<int>& entryList = found[entries[q]];
+                for(int p = 0; p < (int)scores[k].size(); ++p)
+                {
+                    int grey = static_cast<int>(float(scores[k][p]) / findSize * 255);
+                    if(grey >= match_minimum)
+                        entryList.push_back(chunk + p);
+                }
+            }
+        }
+        for(int e = 0; e < entryCount; ++e)//the forward and reverse complement hits of an entry are merged
+            keepHits(found[e], hits[e], bins[e]);
+    }
+    entryHits.swap(hits);
+    entryBins.swap(bins);
+}
+
+/** Each chunk is scanned from reach() nucleotides either side of it, so that every
+  match that starts in the chunk lies wholly inside the text, with the same start as in
+  a scan of the whole sequence.  A match is kept in the chunk it starts in. */
+void HitDensityTrack::scanForExpressions(vector< vector<int> >& hits, vector< vector<unsigned char> >& bins)
+{
+    const string& seq = *sequence;
+    int size = seq.size();
+    string error;
+    vector<MotifHit> matches;
+    vector<int> found;
+    for(int e = 0; e < (int)queries.size(); ++e)
+    {
+        RegexDfa dfa;
+        if(queries[e].empty() || !dfa.compile(queries[e], bothStrands, error))
+            continue;
+        for(int chunk = 0; chunk < size; chunk += chunkSize)
+        {
+            if(cancelled)
+                return;
+            int chunkEnd = min(size, chunk + chunkSize);
+            int begin = max(0, chunk - dfa.reach());
+            int end = min(size, chunkEnd + dfa.reach());
+            matches.clear();
+            dfa.scan(seq.c_str() + begin, end - begin, matches);
+            for(int k = 0; k < (int)matches.size(); ++k)
+            {
+                int start = begin + matches[k].start;
+                if(start >= chunk && start < chunkEnd)
+                    found.push_back(start);
+            }
+            keepHits(found, hits[e], bins[e]);
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef HIT_DENSITY_TRACK
+#define HIT_DENSITY_TRACK
+
+#include <string>
+#include <vector>
+#include <QObject>
+#include <QFuture>
+#include <QFutureWatcher>
+#include <qtconcurrentrun.h>
+
+using namespace std;
+
+/**
+*  Every position in the whole sequence where each highlight query matches, found once on
+*  a worker thread, so that zoomed out views only have to count hits per pixel.
+*/
+class HitDensityTrack : public QObject
+{
+    Q_OBJECT
+
+public:
+    HitDensityTrack(QObject* parent = 0);
+    ~HitDensityTrack();
+    void scan(const string* seq, const vector<string>& patterns, const vector<int>& owners, double similarity);
+    void scanExpressions(const string* seq, const vector<string>& patterns, bool reverseComplement);
+    void cancel();
+    bool isReady();
+    bool isCurrent(const string* seq, const vector<string>& patterns, const vector<int>& owners, double similarity);
+    bool isCurrentExpressions(const string* seq, const vector<string>& patterns, bool reverseComplement);
+    void pixelCounts(int start, int scale, int pixels, vector<int>& counts, vector<int>& winners);
+    const vector<int>* hits(int entry);
+
+    static const int chunkSize = 1 << 18;//nucleotides scanned at a time
+    static const int hitLimit = 1000000;//hits listed per entry before it is binned
+    static const int binSize = 64;//nucleotides per bin, the smallest scale the track is used at
+
+signals:
+    void trackReady();
+
+private slots:
+    void scanFinished();
+
+private:
+    void scanSequence();
+    void scanForExpressions(vector< vector<int> >& hits, vector< vector<unsigned char> >& bins);
+    void keepHits(vector<int>& found, vector<int>& list, vector<unsigned char>& bins);
+    void countRun(int p, int hits, int e, int& pixel, int& run, vector<int>& counts, vector<int>& best, vector<int>& winners);
+
+    const string* sequence;
+    vector<string> queries;
+    vector<int> entries;//entry that queries[i] belongs to
+    double percentage;
+    bool expressions;//queries are regular expressions, one per entry
+    bool bothStrands;//for expressions
+    volatile bool cancelled;
+    bool ready;
+    vector< vector<int> > entryHits;//sorted start positions, one list per entry
+    vector< vector<unsigned char> > entryBins;//hits per binSize, for entries past hitLimit
+    QFuture<void> future;
+    QFutureWatcher<void> watcher;
+};
+
+#endif
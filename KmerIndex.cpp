@@ -0,0 +1,173 @@
+#include "KmerIndex.h"
+#include "SkittleUtil.h"
+#include <algorithm>
+
+/** ***************************************
+KmerIndex is the "BLAST-like" seed index for HighlightDisplay.  Every 10-mer that
+starts at a multiple of 4 is stored under its 2 bit code, so the index costs about
+one byte per nucleotide plus a 4MB bucket table.  The whole sequence is indexed once
+on a worker thread.
+
+A query that matches with at most m mismatches can be split into m+1 segments, and at
+least one of them has to match exactly.  If each segment is at least k+step-1 long, one
+of its first step k-mers starts on a stored position.  Looking those k-mers up gives
+every place the query could match, and only those places need to be compared.  If the
+segments are too short, candidates() says so and the caller compares everywhere, so
+no match is ever lost.
+*******************************************/
+
+KmerIndex::KmerIndex(QObject* parent)
+    :QObject(parent)
+{
+    sequence = NULL;
+    cancelled = false;
+    ready = false;
+    connect(&watcher, SIGNAL(finished()), this, SLOT(buildFinished()));
+}
+
+KmerIndex::~KmerIndex()
+{
+    cancel();
+}
+
+/** Starts indexing seq in the background, unless that is already running or done. */
+void KmerIndex::build(const string* seq)
+{
+    if(seq == NULL)
+        return;
+    if(seq == sequence && (ready || future.isRunning()))
+        return;
+    cancel();
+    sequence = seq;
+    cancelled = false;
+    future = QtConcurrent::run(this, &KmerIndex::indexSequence);
+    watcher.setFuture(future);
+}
+
+/** Blocks until the worker has stopped.  This has to happen before the sequence changes. */
+void KmerIndex::cancel()
+{
+    cancelled = true;
+    future.waitForFinished();
+    ready = false;
+    bucketStart.clear();
+    positions.clear();
+    sequence = NULL;
+}
+
+bool KmerIndex::isReady()
+{
+    return ready;
+}
+
+/** 2 bit code of text[start, start+k), first nucleotide highest.  -1 if any of it is
+  not A, C, G or T. */
+int KmerIndex::encode(const string& text, int start)
+{
+    if(start < 0 || start + k > (int)text.size())
+        return -1;
+    int code = 0;
+    for(int i = start; i < start + k; ++i)
+    {
+        int b = olig_num(text[i]);
+        if(b < 0)
+            return -1;
+        code = (code << 2) | b;
+    }
+    return code;
+}
+
+/** Fills starts with every index in [first, last] where query might match with no more
+  than maxMismatches, sorted.  Returns false if the index can't promise that, because
+  it isn't ready or the query is too short or not all ACGT. */
+bool KmerIndex::candidates(const string& query, int maxMismatches, int first, int last, vector<int>& starts)
+{
+    starts.clear();
+    if(!ready)
+        return false;
+    int segments = max(0, maxMismatches) + 1;
+    int segmentLength = query.size() / segments;
+    if(segmentLength < k + step - 1)
+        return false;
+    for(int i = 0; i < (int)query.size(); ++i)
+        if(olig_num(query[i]) < 0)
+            return false;//a degenerate code past the seeds would go uncompared
+
+    for(int s = 0; s < segments; ++s)
+    {
+        for(int j = 0; j < step; ++j)
+        {
+            int offset = s * segmentLength + j;
+            int code = encode(query, offset);
+            if(code < 0)
+            {
+                starts.clear();
+                return false;
+            }
+            vector<quint32>::const_iterator begin = positions.begin() + bucketStart[code];
+            vector<quint32>::const_iterator end = positions.begin() + bucketStart[code + 1];
+            vector<quint32>::const_iterator hit = lower_bound(begin, end, (quint32)max(0, first + offset));
+            for(; hit != end && (int)*hit <= last + offset; ++hit)
+                starts.push_back((int)*hit - offset);
+        }
+    }
+    sort(starts.begin(), starts.end());
+    starts.erase(unique(starts.begin(), starts.end()), starts.end());
+    return true;
+}
+
+void KmerIndex::buildFinished()
+{
+    if(cancelled || sequence == NULL || bucketStart.empty())
+        return;
+    ready = true;
+    emit indexReady();
+}
+
+/** Runs on the worker thread.  One pass counts each bucket, the second fills them, so
+  positions come out in ascending order. */
+void KmerIndex::indexSequence()
+{
+    const string& seq = *sequence;
+    int size = seq.size();
+    const int buckets = 1 << (2 * k);
+    const int codeMask = buckets - 1;
+    vector<quint32> starts(buckets + 1, 0);
+    vector<quint32> filled;
+    vector<quint32> found;
+
+    for(int pass = 0; pass < 2; ++pass)
+    {
+        int code = 0;
+        int run = 0;//consecutive ACGT ending at i
+        for(int i = 0; i < size; ++i)
+        {
+            if((i & 0xfffff) == 0 && cancelled)
+                return;
+            int b = olig_num(seq[i]);
+            if(b < 0)
+            {
+                run = 0;
+                continue;
+            }
+            code = ((code << 2) | b) & codeMask;
+            int begin = i - k + 1;
+            if(++run >= k && begin % step == 0)
+            {
+                if(pass == 0)
+                    ++starts[code + 1];
+                else
+                    found[filled[code]++] = begin;
+            }
+        }
+        if(pass == 0)
+        {
+            for(int c = 0; c < buckets; ++c)
+                starts[c + 1] += starts[c];
+            found.resize(starts[buckets]);
+            filled.assign(starts.begin(), starts.end() - 1);
+        }
+    }
+    bucketStart.swap(starts);
+    positions.swap(found);
+}
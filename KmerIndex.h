@@ -0,0 +1,52 @@
+#ifndef KMER_INDEX
+#define KMER_INDEX
+
+#include <string>
+#include <vector>
+#include <QObject>
+#include <QFuture>
+#include <QFutureWatcher>
+#include <qtconcurrentrun.h>
+
+using namespace std;
+
+/**
+*  Where every k-mer of the sequence occurs, sampled every few nucleotides.  Built once
+*  on a worker thread, then used to find the few places a query can possibly match
+*  instead of comparing it at every position.
+*/
+class KmerIndex : public QObject
+{
+    Q_OBJECT
+
+public:
+    KmerIndex(QObject* parent = 0);
+    ~KmerIndex();
+    void build(const string* seq);
+    void cancel();
+    bool isReady();
+    bool candidates(const string& query, int maxMismatches, int first, int last, vector<int>& starts);
+
+    static const int k = 10;
+    static const int step = 4;//only k-mers starting at multiples of step are stored
+
+signals:
+    void indexReady();
+
+private slots:
+    void buildFinished();
+
+private:
+    void indexSequence();
+    static int encode(const string& text, int start);
+
+    const string* sequence;
+    volatile bool cancelled;
+    bool ready;
+    vector<quint32> bucketStart;//positions of k-mer c are positions[bucketStart[c]] up to bucketStart[c+1]
+    vector<quint32> positions;//ascending within a bucket
+    QFuture<void> future;
+    QFutureWatcher<void> watcher;
+};
+
+#endif
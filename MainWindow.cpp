@@ -152,6 +152,9 @@ void MainWindow::createUiVars()
     settingToolBar->addWidget(doubleDisplayWidth);
     halveDisplayWidth = new QPushButton("/2",this);
     settingToolBar->addWidget(halveDisplayWidth);
+    snapWidth = new QPushButton("Snap to\nRepeat",this);
+    snapWidth->setToolTip(QString("Set the width to the repeat period under the last Select click"));
+    settingToolBar->addWidget(snapWidth);
     zoomExtents = new QPushButton("Scale to \nChromosome",this);
     settingToolBar->addWidget(zoomExtents);
 
@@ -196,16 +199,16 @@ void MainWindow::createActions()
     screenCaptureAction->setToolTip(QString("Take a screen shot"));
     nextAnnotationAction = new QAction("Next Annotation",this);
     prevAnnotationAction = new QAction("Previous Annotation",this);
+    findNextAction = new QAction("Find Next", this);
+    findNextAction->setStatusTip("Jump to Next Instance of Current Sequence");
+    findPrevAction = new QAction("Find Previous", this);
+    findPrevAction->setStatusTip("Jump to Previous Instance of Current Sequence");
     //browseCommunityAction = new QAction("Browse Community Research",this);
     //delAnnotationAction = new QAction("Delete Current Bookmark",this);
 
     /*****TODO: NOT CURRENTLY IN USE ********/
     findSequenceAction = new QAction("Find Sequence",this);
     findSequenceAction->setStatusTip("Find Arbitrary Sequence");
-    findNextAction = new QAction("Find Next", this);
-    findNextAction->setStatusTip("Jump to Next Instance of Current Sequence");
-    findPrevAction = new QAction("Find Previous", this);
-    findPrevAction->setStatusTip("Jump to Previous Instance of Current Sequence");
 
     QIcon uIcon = QIcon(":/updatebutton.png");
     updateSkittle =new QAction(uIcon, QString("Click here to update"), this);
@@ -234,10 +237,10 @@ void MainWindow::createMenus()
     fileMenu->addAction(openGtfAction);
     fileMenu->addAction(screenCaptureAction);
     fileMenu->addAction(exitAction);
-    /*searchMenu = menuBar()->addMenu("&Search");
-    searchMenu->addAction(findSequenceAction);
+    searchMenu = menuBar()->addMenu("&Search");
+    //searchMenu->addAction(findSequenceAction);
     searchMenu->addAction(findNextAction);
-    searchMenu->addAction(findPrevAction);*/
+    searchMenu->addAction(findPrevAction);
     viewMenu = menuBar()->addMenu("&View");
     presetMenu = viewMenu->addMenu("Visualization Graphs");
 
@@ -413,6 +416,8 @@ void MainWindow::createFileConnections()
     connect(this, SIGNAL(newGtfFileOpen(QString)), viewManager, SLOT(addAnnotationDisplay(QString)));
     connect(nextAnnotationAction, SIGNAL(triggered()), viewManager, SLOT(jumpToNextAnnotation()));
     connect(prevAnnotationAction, SIGNAL(triggered()), viewManager, SLOT(jumpToPrevAnnotation()));
+    connect(findNextAction, SIGNAL(triggered()), viewManager, SLOT(jumpToNextMatch()));
+    connect(findPrevAction, SIGNAL(triggered()), viewManager, SLOT(jumpToPrevMatch()));
 }
 
 void MainWindow::open()
@@ -111,6 +111,7 @@ private:
 
     QPushButton *doubleDisplayWidth;
     QPushButton *halveDisplayWidth;
+    QPushButton *snapWidth;
     QPushButton *zoomExtents;
 
 
@@ -0,0 +1,91 @@
+#include "MyersMatcher.h"
+#include "SkittleUtil.h"
+#include <algorithm>
+
+/** ***************************************
+MyersMatcher lets the Sequence Highlighter find queries that have picked up an
+insertion or deletion, which a fixed alignment scores as noise after the indel.
+It is Myers' bit-vector edit distance algorithm ("A fast bit-vector algorithm for
+approximate string matching based on dynamic programming", 1999), with Hyyro's
+blocks for queries longer than 64.
+
+Each column of the dynamic programming table is stored as vertical deltas: bit i of
+Pv is set if row i is one more than row i-1, and bit i of Mv if it is one less.  Each
+text character updates a whole block of 64 rows with a handful of word operations, and
+the horizontal delta out of the top of a block is carried into the next one.  Row 0 is
+always 0, so a match can start anywhere in the text.
+
+An IUPAC code in the query sets its row in the match masks of every base it allows, so
+R matches A or G at no extra cost.  Letters that aren't codes only match themselves.
+*******************************************/
+
+MyersMatcher::MyersMatcher(const string& query)
+{
+    queryLength = query.size();
+    blocks = max(1, (queryLength + 63) / 64);
+    int lastRow = (queryLength - 1) % 64;
+    lastBit = Q_UINT64_C(1) << (lastRow < 0 ? 0 : lastRow);
+    peq.assign(256 * blocks, 0);
+    for(int i = 0; i < queryLength; ++i)
+    {
+        quint64 row = Q_UINT64_C(1) << (i % 64);
+        int bases = iupacMask(query[i]);
+        if(bases == 0)
+            peq[(unsigned char)query[i] * blocks + i / 64] |= row;
+        for(int b = 0; b < 4; ++b)
+        {
+            if(bases & (1 << b))
+                peq[(unsigned char)num_olig(b) * blocks + i / 64] |= row;
+        }
+    }
+}
+
+/** distances[j] is the fewest edits that turn the query into some substring of text
+  ending at j. */
+void MyersMatcher::search(const char* text, int length, vector<int>& distances)
+{
+    distances.assign(max(0, length), queryLength);
+    if(queryLength == 0)
+        return;
+    vector<quint64> positive(blocks, ~Q_UINT64_C(0));
+    vector<quint64> negative(blocks, 0);
+    int score = queryLength;
+    const quint64 high = Q_UINT64_C(1) << 63;
+
+    for(int j = 0; j < length; ++j)
+    {
+        const quint64* eqColumn = &peq[(unsigned char)text[j] * blocks];
+        int carry = 0;//horizontal delta coming into the bottom row of the block
+        for(int b = 0; b < blocks; ++b)
+        {
+            quint64 Pv = positive[b];
+            quint64 Mv = negative[b];
+            quint64 Eq = eqColumn[b];
+            quint64 Xv = Eq | Mv;
+            if(carry < 0)
+                Eq |= 1;
+            quint64 Xh = (((Eq & Pv) + Pv) ^ Pv) | Eq;
+            quint64 Ph = Mv | ~(Xh | Pv);
+            quint64 Mh = Pv & Xh;
+
+            quint64 top = (b == blocks - 1) ? lastBit : high;
+            int out = 0;
+            if(Ph & top)
+                out = 1;
+            else if(Mh & top)
+                out = -1;
+
+            Ph <<= 1;
+            Mh <<= 1;
+            if(carry < 0)
+                Mh |= 1;
+            else if(carry > 0)
+                Ph |= 1;
+            positive[b] = Mh | ~(Xv | Ph);
+            negative[b] = Ph & Xv;
+            carry = out;
+        }
+        score += carry;
+        distances[j] = score;
+    }
+}
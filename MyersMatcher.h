@@ -0,0 +1,28 @@
+#ifndef MYERS_MATCHER
+#define MYERS_MATCHER
+
+#include <string>
+#include <vector>
+#include <QtGlobal>
+
+using namespace std;
+
+/**
+*  Edit distance (substitutions, insertions and deletions) between a query and the best
+*  matching substring ending at every position of a text, using Myers' bit-vector
+*  algorithm.  One 64 bit word of state per 64 nucleotides of query.
+*/
+class MyersMatcher
+{
+public:
+    MyersMatcher(const string& query);
+    void search(const char* text, int length, vector<int>& distances);
+
+private:
+    int queryLength;
+    int blocks;
+    quint64 lastBit;//row of the last query nucleotide in the last block
+    vector<quint64> peq;//peq[c * blocks + b]: query positions in block b that equal c
+};
+
+#endif
@@ -0,0 +1,259 @@
+#include "OverviewPyramid.h"
+#include "RepeatOverviewDisplay.h"
+#include "SkittleUtil.h"
+#include <QFile>
+#include <QDataStream>
+#include <algorithm>
+
+/** ***************************************
+OverviewPyramid lets RepeatOverview zoom out to a whole chromosome without scanning
+every nucleotide again each frame.  One background pass runs getBestAlignment() on
+every 16bp cell of the sequence.  Each level above that merges pairs of cells: the
+period of the better scoring cell wins and the scores are averaged.  So hue follows
+the dominant repeat and brightness follows how repetitive the region is overall.
+This is an approximation of a rescan at the coarser scale, which is why
+RepeatOverview only uses the pyramid when each pixel covers several cells.
+
+The pyramid is saved as "<sequence file>-skittle_overview", next to the skittle_notes
+file.  The header holds the scan range, the sequence size and a checksum of sampled nucleotides, so
+a stale file for an edited sequence is ignored and rebuilt.
+*******************************************/
+
+static const quint32 pyramidMagic = 0x534b4f56;//"SKOV"
+static const quint32 pyramidVersion = 2;
+
+OverviewPyramid::OverviewPyramid(QObject* parent)
+    :QObject(parent)
+{
+    overview = NULL;
+    sequence = NULL;
+    range = 0;
+    cancelled = false;
+    ready = false;
+    connect(&watcher, SIGNAL(finished()), this, SLOT(buildFinished()));
+}
+
+OverviewPyramid::~OverviewPyramid()
+{
+    cancel();
+}
+
+/** Loads the pyramid from cacheFile, or builds and saves it, on a worker thread.  The
+  display's packed sequence must be current. An empty cacheFile skips the disk. */
+void OverviewPyramid::build(RepeatOverviewDisplay* display, const string* seq, QString cacheFile, int scanRange)
+{
+    if(seq == NULL)
+        return;
+    if(seq == sequence && scanRange == range && (ready || future.isRunning()))
+        return;
+    cancel();
+    overview = display;
+    sequence = seq;
+    fileName = cacheFile;
+    range = scanRange;
+    cancelled = false;
+    future = QtConcurrent::run(this, &OverviewPyramid::buildLevels);
+    watcher.setFuture(future);
+}
+
+void OverviewPyramid::cancel()
+{
+    cancelled = true;
+    future.waitForFinished();
+    ready = false;
+    scores.clear();
+    periods.clear();
+    sequence = NULL;
+}
+
+bool OverviewPyramid::isReady()
+{
+    return ready;
+}
+
+bool OverviewPyramid::isBuilding()
+{
+    return future.isRunning();
+}
+
+static inline void mergeCells(quint8 scoreA, quint16 periodA, quint8 scoreB, quint16 periodB,
+                              quint8& score, quint16& period)
+{
+    if(scoreA > scoreB || (scoreA == scoreB && periodA <= periodB))
+        period = periodA;
+    else
+        period = periodB;
+    score = (quint8)((scoreA + scoreB + 1) / 2);
+}
+
+/** Score (0-1) and period for [start, start+length), merged from the coarsest level
+  whose cells still fit inside the range.  Cells at the edges count in proportion to
+  their overlap.  Returns false if the pyramid can't answer. */
+bool OverviewPyramid::lookup(int start, int length, float& score, int& period)
+{
+    if(!ready || scores.empty() || length < baseScale)
+        return false;
+
+    int level = 0;
+    while(level + 1 < (int)scores.size() && (baseScale << (level + 1)) <= length)
+        ++level;
+    int cell = baseScale << level;
+    const vector<quint8>& levelScores = scores[level];
+    const vector<quint16>& levelPeriods = periods[level];
+    int end = start + length;
+    int first = max(0, start / cell);
+    int last = min((int)levelScores.size() - 1, (end - 1) / cell);
+    if(first > last)
+        return false;
+
+    //at most 3 cells overlap, since cells are more than half of length
+    int candidates[4];
+    double votes[4];
+    int distinct = 0;
+    double total = 0.0;
+    for(int c = first; c <= last && c < first + 4; ++c)
+    {
+        int overlap = min(end, (c + 1) * cell) - max(start, c * cell);
+        double weighted = levelScores[c] * double(overlap);
+        total += weighted;
+        int k = 0;
+        while(k < distinct && candidates[k] != levelPeriods[c])
+            ++k;
+        if(k == distinct)
+        {
+            candidates[distinct] = levelPeriods[c];
+            votes[distinct++] = 0.0;
+        }
+        votes[k] += weighted;
+    }
+    int winner = 0;
+    for(int k = 1; k < distinct; ++k)
+        if(votes[k] > votes[winner] || (votes[k] == votes[winner] && candidates[k] < candidates[winner]))
+            winner = k;
+
+    score = total / (255.0 * length);
+    period = candidates[winner];
+    return true;
+}
+
+void OverviewPyramid::buildFinished()
+{
+    if(cancelled || sequence == NULL || scores.empty())
+        return;
+    ready = true;
+    emit pyramidReady();
+}
+
+/** Runs on the worker thread.  scores and periods are only read once buildFinished() has run. */
+void OverviewPyramid::buildLevels()
+{
+    if(load())
+        return;
+    scanBaseLevel();
+    if(cancelled)
+        return;
+    mergeLevels();
+    save();
+}
+
+void OverviewPyramid::scanBaseLevel()
+{
+    int cells = ((int)sequence->size() + baseScale - 1) / baseScale;
+    vector<quint8> cellScores(cells, 0);
+    vector<quint16> cellPeriods(cells, 0);
+    for(int c = 0; c < cells; ++c)
+    {
+        if((c & 1023) == 0 && cancelled)
+            return;
+        pair<int,int> best = overview->getBestAlignment(c * baseScale, baseScale);
+        cellScores[c] = (quint8)(best.first * 255 / baseScale);
+        cellPeriods[c] = (quint16)best.second;
+    }
+    scores.assign(1, vector<quint8>());
+    periods.assign(1, vector<quint16>());
+    scores[0].swap(cellScores);
+    periods[0].swap(cellPeriods);
+}
+
+void OverviewPyramid::mergeLevels()
+{
+    while(scores.back().size() > 1)
+    {
+        const vector<quint8>& belowScores = scores.back();
+        const vector<quint16>& belowPeriods = periods.back();
+        int count = (belowScores.size() + 1) / 2;
+        vector<quint8> aboveScores(count, 0);
+        vector<quint16> abovePeriods(count, 0);
+        for(int i = 0; i < count; ++i)
+        {
+            int a = 2 * i;
+            int b = min(a + 1, (int)belowScores.size() - 1);
+            mergeCells(belowScores[a], belowPeriods[a], belowScores[b], belowPeriods[b],
+                       aboveScores[i], abovePeriods[i]);
+        }
+        scores.push_back(aboveScores);
+        periods.push_back(abovePeriods);
+    }
+}
+
+bool OverviewPyramid::load()
+{
+    if(fileName.isEmpty() || !QFile::exists(fileName))
+        return false;
+    QFile file(fileName);
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_4_4);
+
+    quint32 magic, version, scanRange, size, scale, sum, levels;
+    in >> magic >> version >> scanRange >> size >> scale >> sum >> levels;
+    if(magic != pyramidMagic || version != pyramidVersion || scanRange != (quint32)range
+            || size != sequence->size() || scale != (quint32)baseScale || sum != sidecarChecksum(*sequence) || levels > 64)
+        return false;
+
+    vector< vector<quint8> > fileScores(levels);
+    vector< vector<quint16> > filePeriods(levels);
+    for(quint32 l = 0; l < levels && !cancelled; ++l)
+    {
+        quint32 count;
+        in >> count;
+        if(in.status() != QDataStream::Ok || count > size)
+            return false;
+        fileScores[l].resize(count);
+        filePeriods[l].resize(count);
+        if(count > 0 && in.readRawData((char*)&fileScores[l][0], count) != (int)count)
+            return false;
+        for(quint32 i = 0; i < count; ++i)
+            in >> filePeriods[l][i];
+    }
+    if(cancelled || in.status() != QDataStream::Ok || fileScores.empty())
+        return false;
+    scores.swap(fileScores);
+    periods.swap(filePeriods);
+    return true;
+}
+
+bool OverviewPyramid::save()
+{
+    if(fileName.isEmpty())
+        return false;
+    QFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;//read only directory, it will just be rebuilt next time
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_4_4);
+
+    out << pyramidMagic << pyramidVersion << (quint32)range << (quint32)sequence->size() << (quint32)baseScale
+        << sidecarChecksum(*sequence) << (quint32)scores.size();
+    for(int l = 0; l < (int)scores.size(); ++l)
+    {
+        quint32 count = scores[l].size();
+        out << count;
+        if(count > 0)
+            out.writeRawData((const char*)&scores[l][0], count);
+        for(quint32 i = 0; i < count; ++i)
+            out << periods[l][i];
+    }
+    return out.status() == QDataStream::Ok;
+}
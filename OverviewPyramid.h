@@ -0,0 +1,61 @@
+#ifndef OVERVIEW_PYRAMID
+#define OVERVIEW_PYRAMID
+
+#include <string>
+#include <vector>
+#include <QObject>
+#include <QString>
+#include <QFuture>
+#include <QFutureWatcher>
+#include <qtconcurrentrun.h>
+
+using namespace std;
+
+class RepeatOverviewDisplay;
+
+/**
+*  Best (score, period) pairs for the whole sequence at a fine scale, plus coarser
+*  levels made by merging pairs of cells.  Built once in the background and saved
+*  next to the sequence file so that later sessions only need to read it.
+*/
+class OverviewPyramid : public QObject
+{
+    Q_OBJECT
+
+public:
+    OverviewPyramid(QObject* parent = 0);
+    ~OverviewPyramid();
+    void build(RepeatOverviewDisplay* display, const string* seq, QString cacheFile, int scanRange);
+    void cancel();
+    bool isReady();
+    bool isBuilding();
+    bool lookup(int start, int length, float& score, int& period);
+
+    static const int baseScale = 16;
+
+signals:
+    void pyramidReady();
+
+private slots:
+    void buildFinished();
+
+private:
+    void buildLevels();
+    void scanBaseLevel();
+    void mergeLevels();
+    bool load();
+    bool save();
+
+    RepeatOverviewDisplay* overview;
+    const string* sequence;
+    QString fileName;
+    int range;//the scan range the scores were made with
+    volatile bool cancelled;
+    bool ready;
+    vector< vector<quint8> > scores;//score / baseScale << level, scaled to 0-255
+    vector< vector<quint16> > periods;
+    QFuture<void> future;
+    QFutureWatcher<void> watcher;
+};
+
+#endif
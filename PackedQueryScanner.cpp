@@ -0,0 +1,193 @@
+#include "PackedQueryScanner.h"
+#include "SkittleUtil.h"
+#include <algorithm>
+
+/** ***************************************
+PackedQueryScanner replaces the letter by letter loop in HighlightDisplay::calculateLetters()
+for queries made of IUPAC nucleotide codes.  The view is packed into a PackedSequence, and
+each query is packed into 2 bit words the same way.  At each position the words read
+from the text are XORed with the query, each nucleotide's pair of bits is folded into
+one with (x | x >> 1), and a popcount gives the mismatches for 32 nucleotides.  N and
+other letters in the text are marked by the known mask and always count as mismatches,
+the same as comparing letters.
+
+Queries with degenerate codes (R, Y, N...) keep a 4 bit mask of allowed bases for each
+position, stored as four bit planes: allowed[4k + b] has a 1 in every lane of word k
+that allows base b.  The text's 2 bit codes are split into the same four one hot planes
+once per block position, and a lane matches if its base's plane and the query's plane
+are both set.  That is still 32 nucleotides per step, with no branches.
+
+The text is worked through in blocks of 4096 positions.  The words at every position
+of a block are read once into blockBases and blockKnown, then every query is scored
+against that block while it is still in cache.
+*******************************************/
+
+PackedQueryScanner::PackedQueryScanner()
+{
+}
+
+/** Returns false, and adds nothing, if query is empty or has a letter that isn't an
+  IUPAC nucleotide code. */
+bool PackedQueryScanner::addQuery(const string& query)
+{
+    if(query.empty())
+        return false;
+    PackedQuery packedQuery;
+    packedQuery.length = query.size();
+    packedQuery.degenerate = false;
+    int words = (packedQuery.length + 31) / 32;
+    packedQuery.words.assign(words, 0);
+    packedQuery.masks.assign(words, 0);
+    packedQuery.allowed.assign(4 * words, 0);
+    for(int i = 0; i < packedQuery.length; ++i)
+    {
+        int bases = iupacMask(query[i]);
+        if(bases == 0)
+            return false;
+        int shift = (i & 31) * 2;
+        for(int b = 0; b < 4; ++b)
+        {
+            if(bases & (1 << b))
+                packedQuery.allowed[4 * (i >> 5) + b] |= Q_UINT64_C(1) << shift;
+        }
+        if(bases != 1 && bases != 2 && bases != 4 && bases != 8)
+            packedQuery.degenerate = true;
+        else
+            packedQuery.words[i >> 5] |= (quint64)olig_num(query[i]) << shift;
+        packedQuery.masks[i >> 5] |= Q_UINT64_C(1) << shift;
+    }
+    queries.push_back(packedQuery);
+    return true;
+}
+
+/** Splits 2 bit codes into one hot planes for A, C, G and T.  Unknown lanes are in none. */
+static inline void splitPlanes(quint64 text, quint64 known, quint64* planes)
+{
+    quint64 low = text & known;
+    quint64 high = (text >> 1) & known;
+    planes[0] = known & ~high & ~low;
+    planes[1] = ~high & low;
+    planes[2] = high & ~low;
+    planes[3] = high & low;
+}
+
+/** Lanes of mask where the text's planes hold a base that allowed doesn't allow. */
+static inline quint64 degenerateMismatches(const quint64* planes, const quint64* allowed, quint64 mask)
+{
+    quint64 match = (planes[0] & allowed[0]) | (planes[1] & allowed[1])
+                  | (planes[2] & allowed[2]) | (planes[3] & allowed[3]);
+    return ~match & mask;
+}
+
+/** Scores query at positions [blockStart, end) from the words read into the block. */
+KERNEL_INLINE
+void PackedQueryScanner::scoreBlock(const PackedQuery& query, int blockStart, int end, unsigned short int* out)
+{
+    int words = query.words.size();
+    if(query.degenerate)
+    {
+        const quint64* allowed = &query.allowed[0];
+        if(words == 1)
+        {
+            quint64 mask = query.masks[0];
+            for(int p = blockStart; p < end; ++p)
+                out[p] = query.length - popcount64(degenerateMismatches(&blockPlanes[4 * (p - blockStart)], allowed, mask));
+            return;
+        }
+        for(int p = blockStart; p < end; ++p)
+        {
+            int i = p - blockStart;
+            int mismatches = 0;
+            for(int k = 0; k < words; ++k)
+                mismatches += popcount64(degenerateMismatches(&blockPlanes[4 * (i + k * 32)],
+                                                              allowed + 4 * k, query.masks[k]));
+            out[p] = query.length - mismatches;
+        }
+        return;
+    }
+    if(words == 1)//up to 32bp, the usual primer or motif
+    {
+        quint64 word = query.words[0];
+        quint64 mask = query.masks[0];
+        for(int p = blockStart; p < end; ++p)
+        {
+            int i = p - blockStart;
+            quint64 x = blockBases[i] ^ word;
+            out[p] = query.length - popcount64(((x | (x >> 1)) | ~blockKnown[i]) & mask);
+        }
+        return;
+    }
+    for(int p = blockStart; p < end; ++p)
+    {
+        int i = p - blockStart;
+        int mismatches = 0;
+        for(int k = 0; k < words; ++k)
+        {
+            quint64 x = blockBases[i + k * 32] ^ query.words[k];
+            mismatches += popcount64(((x | (x >> 1)) | ~blockKnown[i + k * 32]) & query.masks[k]);
+        }
+        out[p] = query.length - mismatches;
+    }
+}
+
+#ifdef PACKED_POPCNT_KERNEL
+POPCNT_TARGET
+void PackedQueryScanner::scoreBlockPopcnt(const PackedQuery& query, int blockStart, int end, unsigned short int* out)
+{
+    scoreBlock(query, blockStart, end, out);
+}
+#endif
+
+int PackedQueryScanner::queryCount()
+{
+    return queries.size();
+}
+
+/** scores[q][p] is how many nucleotides of query q match text starting at p, for every p
+  where the query fits in the text, up to maxPositions. */
+void PackedQueryScanner::scan(const char* text, int length, int maxPositions, vector< vector<unsigned short int> >& scores)
+{
+    scores.assign(queries.size(), vector<unsigned short int>());
+    int longest = 0;
+    int positions = 0;
+    bool degenerate = false;
+    for(int q = 0; q < (int)queries.size(); ++q)
+    {
+        scores[q].assign(max(0, min(maxPositions, length - queries[q].length + 1)), 0);
+        longest = max(longest, queries[q].length);
+        positions = max(positions, (int)scores[q].size());
+        degenerate = degenerate || queries[q].degenerate;
+    }
+    if(positions == 0)
+        return;
+
+    packed.pack(text, length);
+    int reach = ((longest + 31) / 32) * 32;//words past a position that a query can read
+    blockBases.resize(blockSize + reach);
+    blockKnown.resize(blockSize + reach);
+    blockPlanes.resize(degenerate ? 4 * (blockSize + reach) : 0);
+    for(int blockStart = 0; blockStart < positions; blockStart += blockSize)
+    {
+        int span = min(blockSize + reach, length - blockStart);
+        for(int i = 0; i < span; ++i)
+        {
+            blockBases[i] = packed.bases(blockStart + i);
+            blockKnown[i] = packed.known(blockStart + i);
+            if(degenerate)
+                splitPlanes(blockBases[i], blockKnown[i], &blockPlanes[4 * i]);
+        }
+        for(int q = 0; q < (int)queries.size(); ++q)
+        {
+            unsigned short int* out = scores[q].empty() ? NULL : &scores[q][0];
+            int end = min(blockStart + blockSize, (int)scores[q].size());
+#ifdef PACKED_POPCNT_KERNEL
+            if(PackedSequence::hardwarePopcount())
+            {
+                scoreBlockPopcnt(queries[q], blockStart, end, out);
+                continue;
+            }
+#endif
+            scoreBlock(queries[q], blockStart, end, out);
+        }
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef PACKED_QUERY_SCANNER
+#define PACKED_QUERY_SCANNER
+
+#include <string>
+#include <vector>
+#include "PackedSequence.h"
+
+using namespace std;
+
+/**
+*  Counts the matching nucleotides of several queries at every position of a text,
+*  comparing 32 nucleotides per XOR, or per set of ANDs for IUPAC codes.  All of the queries are run over one small block of
+*  the text before moving on to the next, so the text is read from cache.
+*/
+class PackedQueryScanner
+{
+public:
+    PackedQueryScanner();
+    bool addQuery(const string& query);
+    int queryCount();
+    void scan(const char* text, int length, int maxPositions, vector< vector<unsigned short int> >& scores);
+
+    static const int blockSize = 4096;
+
+private:
+    struct PackedQuery
+    {
+        int length;
+        vector<quint64> words;
+        vector<quint64> masks;//low bit of every lane in use
+        bool degenerate;//has a code other than A, C, G or T
+        vector<quint64> allowed;//4 words per word of masks: lanes that allow A, C, G, T
+    };
+
+    void scoreBlock(const PackedQuery& query, int blockStart, int end, unsigned short int* out);
+#ifdef PACKED_POPCNT_KERNEL
+    POPCNT_TARGET void scoreBlockPopcnt(const PackedQuery& query, int blockStart, int end, unsigned short int* out);
+#endif
+
+    vector<PackedQuery> queries;
+    PackedSequence packed;
+    vector<quint64> blockBases;
+    vector<quint64> blockKnown;
+    vector<quint64> blockPlanes;//one hot A, C, G, T words at each position, for degenerate queries
+};
+
+#endif
@@ -0,0 +1,248 @@
+#include "PackedSequence.h"
+#include <algorithm>
+
+#ifdef PACKED_POPCNT_KERNEL
+#define PACKED_AVX2_KERNEL
+#include <immintrin.h>
+#endif
+
+/** ***************************************
+PackedSequence stores a stretch of sequence at 2 bits per nucleotide so that 32
+nucleotides can be compared with one XOR.  Two lanes match when both bits of
+their XOR are zero, so (x | x >> 1) & 0x5555... has a 1 in every mismatching lane
+and popcount64() counts them.  N and other unknown characters are stored as A, but
+are left out of knownMask so that they never count as a match.
+
+The complement of a 2 bit code is code ^ 3 (A<->T, C<->G), so the reverse complement
+strand is packed from the same codes in reverse order.  reverseMatches() then costs
+exactly the same as matches().
+
+Words are read at any nucleotide offset, not only multiples of 32.  The word arrays
+carry two words of padding so a read near the end never runs off the array.
+
+mismatches() is the kernel under RepeatOverview, which compares one reference
+against hundreds of offsets.  On x86 CPUs with AVX2 it does 8 words per step and
+counts bits with a nibble lookup table; everywhere else it's one word at a time.
+
+The build doesn't assume the popcnt instruction.  matches(), reverseMatches() and
+mismatches() each have a clone compiled for it, chosen at run time by hardwarePopcount(),
+so the same binary still runs on CPUs without it.
+*******************************************/
+
+PackedSequence::PackedSequence()
+{
+    length = 0;
+}
+
+void PackedSequence::pack(const char* seq, int len, bool withReverseComplement)
+{
+    length = max(0, len);
+    int words = (length + 31) / 32 + 2;
+    codes.assign(words, 0);
+    knownMask.assign(words, 0);
+    reverseCodes.assign(withReverseComplement ? words : 0, 0);
+    reverseKnownMask.assign(withReverseComplement ? words : 0, 0);
+    for(int i = 0; i < length; ++i)
+    {
+        quint64 code = 0;
+        switch(seq[i])
+        {
+        case 'A': code = 0; break;
+        case 'C': code = 1; break;
+        case 'G': code = 2; break;
+        case 'T': code = 3; break;
+        default: continue;//unknown, leave it out of knownMask
+        }
+        int shift = (i & 31) * 2;
+        codes[i >> 5] |= code << shift;
+        knownMask[i >> 5] |= Q_UINT64_C(1) << shift;
+        if(withReverseComplement)
+        {
+            int r = length - 1 - i;
+            int reverseShift = (r & 31) * 2;
+            reverseCodes[r >> 5] |= (code ^ 3) << reverseShift;
+            reverseKnownMask[r >> 5] |= Q_UINT64_C(1) << reverseShift;
+        }
+    }
+}
+
+int PackedSequence::size() const
+{
+    return length;
+}
+
+#ifdef PACKED_POPCNT_KERNEL
+static bool cpuHasPopcnt()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("popcnt");
+}
+
+static const bool usePopcnt = cpuHasPopcnt();
+#endif
+
+/** True if the POPCNT_TARGET clones can be called on this CPU. */
+bool PackedSequence::hardwarePopcount()
+{
+#ifdef PACKED_POPCNT_KERNEL
+    return usePopcnt;
+#else
+    return false;
+#endif
+}
+
+/** Body of matches() and reverseMatches().  reverse is a constant wherever it's inlined. */
+static KERNEL_INLINE int countMatches(const PackedSequence& packed, int a, int b, int len, bool reverse)
+{
+    int count = 0;
+    for(int i = 0; i < len; i += 32)
+    {
+        quint64 x = packed.bases(a + i) ^ (reverse ? packed.reverseBases(b + i) : packed.bases(b + i));
+        quint64 same = ~(x | (x >> 1)) & packed.known(a + i)
+                & (reverse ? packed.reverseKnown(b + i) : packed.known(b + i)) & PackedSequence::lowBits;
+        int remaining = len - i;
+        if(remaining < 32)
+            same &= (Q_UINT64_C(1) << (2 * remaining)) - 1;
+        count += popcount64(same);
+    }
+    return count;
+}
+
+#ifdef PACKED_POPCNT_KERNEL
+POPCNT_TARGET
+static int countMatchesPopcnt(const PackedSequence& packed, int a, int b, int len, bool reverse)
+{
+    return reverse ? countMatches(packed, a, b, len, true) : countMatches(packed, a, b, len, false);
+}
+#endif
+
+/** Number of positions i in [0, length) where both a+i and b+i are known and equal. */
+int PackedSequence::matches(int a, int b, int len) const
+{
+#ifdef PACKED_POPCNT_KERNEL
+    if(usePopcnt)
+        return countMatchesPopcnt(*this, a, b, len, false);
+#endif
+    return countMatches(*this, a, b, len, false);
+}
+
+/** Same as matches(), but b indexes the reverse complement strand.  Position i of the
+  reverse strand pairs with length-1-i of the forward strand. */
+int PackedSequence::reverseMatches(int a, int b, int len) const
+{
+#ifdef PACKED_POPCNT_KERNEL
+    if(usePopcnt)
+        return countMatchesPopcnt(*this, a, b, len, true);
+#endif
+    return countMatches(*this, a, b, len, true);
+}
+
+#ifdef PACKED_AVX2_KERNEL
+static bool cpuHasAvx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+static const bool useAvx2 = cpuHasAvx2();
+
+/** Mismatching lanes in the first words of reference vs target words shifted right by
+  shift bits.  words must be a multiple of 8. Two folded vectors share one popcount:
+  the fold leaves only even bits, so the second is shifted onto the odd bits. */
+__attribute__((target("avx2")))
+static int mismatchesAvx2(const quint64* reference, const quint64* target, int shift, int words)
+{
+    __m128i right = _mm_cvtsi32_si128(shift);
+    __m128i left = _mm_cvtsi32_si128(64 - shift);//a count of 64 shifts in zeros
+    const __m256i low = _mm256_set1_epi64x((long long)PackedSequence::lowBits);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i bitsInNibble = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+                                                  0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    __m256i total = _mm256_setzero_si256();
+    for(int k = 0; k < words; k += 8)
+    {
+        __m256i r1 = _mm256_loadu_si256((const __m256i*)(reference + k));
+        __m256i r2 = _mm256_loadu_si256((const __m256i*)(reference + k + 4));
+        __m256i t1 = _mm256_or_si256(_mm256_srl_epi64(_mm256_loadu_si256((const __m256i*)(target + k)), right),
+                                     _mm256_sll_epi64(_mm256_loadu_si256((const __m256i*)(target + k + 1)), left));
+        __m256i t2 = _mm256_or_si256(_mm256_srl_epi64(_mm256_loadu_si256((const __m256i*)(target + k + 4)), right),
+                                     _mm256_sll_epi64(_mm256_loadu_si256((const __m256i*)(target + k + 5)), left));
+        __m256i x1 = _mm256_xor_si256(r1, t1);
+        __m256i x2 = _mm256_xor_si256(r2, t2);
+        x1 = _mm256_and_si256(_mm256_or_si256(x1, _mm256_srli_epi64(x1, 1)), low);
+        x2 = _mm256_and_si256(_mm256_or_si256(x2, _mm256_srli_epi64(x2, 1)), low);
+        __m256i both = _mm256_or_si256(x1, _mm256_slli_epi64(x2, 1));
+        __m256i counts = _mm256_add_epi8(
+                    _mm256_shuffle_epi8(bitsInNibble, _mm256_and_si256(both, nibble)),
+                    _mm256_shuffle_epi8(bitsInNibble, _mm256_and_si256(_mm256_srli_epi16(both, 4), nibble)));
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(counts, _mm256_setzero_si256()));
+    }
+    long long sums[4];
+    _mm256_storeu_si256((__m256i*)sums, total);
+    return (int)(sums[0] + sums[1] + sums[2] + sums[3]);
+}
+#endif
+
+/** Body of mismatches().  words and shift locate the target nucleotide. */
+static KERNEL_INLINE int countMismatches(const quint64* reference, int len, const quint64* words, int shift)
+{
+    const quint64 lowBits = PackedSequence::lowBits;
+    int back = 64 - shift;
+    int full = (len - 1) >> 5;//every word but the last is full
+    int count = 0;
+    int k = 0;
+#ifdef PACKED_AVX2_KERNEL
+    if(useAvx2 && full >= 8)
+    {
+        k = full & ~7;
+        count = mismatchesAvx2(reference, words, shift, k);
+    }
+#endif
+    quint64 x;
+    if(shift == 0)
+    {
+        for(; k < full; ++k)
+        {
+            x = reference[k] ^ words[k];
+            count += popcount64((x | (x >> 1)) & lowBits);
+        }
+        x = reference[full] ^ words[full];
+    }
+    else
+    {
+        for(; k < full; ++k)
+        {
+            x = reference[k] ^ ((words[k] >> shift) | (words[k + 1] << back));
+            count += popcount64((x | (x >> 1)) & lowBits);
+        }
+        x = reference[full] ^ ((words[full] >> shift) | (words[full + 1] << back));
+    }
+    int remaining = len - full * 32;
+    quint64 lastMask = lowBits;
+    if(remaining < 32)
+        lastMask &= (Q_UINT64_C(1) << (2 * remaining)) - 1;
+    count += popcount64((x | (x >> 1)) & lastMask);
+    return count;
+}
+
+#ifdef PACKED_POPCNT_KERNEL
+POPCNT_TARGET
+static int countMismatchesPopcnt(const quint64* reference, int len, const quint64* words, int shift)
+{
+    return countMismatches(reference, len, words, shift);
+}
+#endif
+
+/** reference holds length nucleotides as read by bases(), 32 per word.  Returns how many
+  of them differ from the sequence starting at target.  Unlike matches(), N is not
+  masked out here: it compares as A. */
+int PackedSequence::mismatches(const quint64* reference, int len, int target) const
+{
+    const quint64* words = &codes[target >> 5];
+    int shift = (target & 31) * 2;
+#ifdef PACKED_POPCNT_KERNEL
+    if(usePopcnt)
+        return countMismatchesPopcnt(reference, len, words, shift);
+#endif
+    return countMismatches(reference, len, words, shift);
+}
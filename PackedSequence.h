@@ -0,0 +1,111 @@
+#ifndef PACKED_SEQUENCE
+#define PACKED_SEQUENCE
+
+#include <string>
+#include <vector>
+#include <QtGlobal>
+
+using namespace std;
+
+/** Kernels that lean on popcount64() are written once as KERNEL_INLINE bodies and
+  compiled a second time inside a POPCNT_TARGET clone, which is only called when
+  PackedSequence::hardwarePopcount() says the CPU has the instruction. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) \
+    && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || defined(__clang__))
+#define PACKED_POPCNT_KERNEL
+#define POPCNT_TARGET __attribute__((target("popcnt")))
+#define KERNEL_INLINE inline __attribute__((always_inline))
+#else
+#define POPCNT_TARGET
+#define KERNEL_INLINE inline
+#endif
+
+/**
+*  2 bits per nucleotide (A=0, C=1, G=2, T=3), 32 nucleotides per 64 bit word, with a
+*  parallel mask that marks which lanes held a real nucleotide rather than N.
+*  Optionally the reverse complement strand is packed alongside it.
+*/
+class PackedSequence
+{
+public:
+    PackedSequence();
+    void pack(const char* seq, int length, bool withReverseComplement = false);
+    int size() const;
+    quint64 bases(int index) const;
+    quint64 known(int index) const;
+    quint64 reverseBases(int index) const;
+    quint64 reverseKnown(int index) const;
+    const quint64* codeWords() const;
+    int matches(int a, int b, int length) const;
+    int reverseMatches(int a, int b, int length) const;
+    int mismatches(const quint64* reference, int length, int target) const;
+    static bool hardwarePopcount();
+
+    static const quint64 lowBits = Q_UINT64_C(0x5555555555555555);
+
+private:
+    static quint64 readWord(const vector<quint64>& words, int index);
+
+    int length;
+    vector<quint64> codes;
+    vector<quint64> knownMask;//0b01 in every lane that is A, C, G or T
+    vector<quint64> reverseCodes;//reverseCodes[i] is the complement of codes[length-1-i]
+    vector<quint64> reverseKnownMask;
+};
+
+inline int popcount64(quint64 x)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & Q_UINT64_C(0x5555555555555555));
+    x = (x & Q_UINT64_C(0x3333333333333333)) + ((x >> 2) & Q_UINT64_C(0x3333333333333333));
+    x = (x + (x >> 4)) & Q_UINT64_C(0x0f0f0f0f0f0f0f0f);
+    return (int)((x * Q_UINT64_C(0x0101010101010101)) >> 56);
+#endif
+}
+
+/** 32 nucleotides starting at index.  The first one is in the lowest 2 bits. */
+inline
+quint64 PackedSequence::bases(int index) const
+{
+    return readWord(codes, index);
+}
+
+inline
+quint64 PackedSequence::known(int index) const
+{
+    return readWord(knownMask, index);
+}
+
+inline
+quint64 PackedSequence::reverseBases(int index) const
+{
+    return readWord(reverseCodes, index);
+}
+
+inline
+quint64 PackedSequence::reverseKnown(int index) const
+{
+    return readWord(reverseKnownMask, index);
+}
+
+/** Raw words for kernels that keep their own read position.  Padded by two words. */
+inline
+const quint64* PackedSequence::codeWords() const
+{
+    return &codes[0];
+}
+
+inline
+quint64 PackedSequence::readWord(const vector<quint64>& words, int index)
+{
+    int w = index >> 5;
+    int shift = (index & 31) * 2;
+    quint64 value = words[w] >> shift;
+    if(shift != 0)
+        value |= words[w + 1] << (64 - shift);
+    return value;
+}
+
+#endif
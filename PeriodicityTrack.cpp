@@ -0,0 +1,139 @@
+#include "PeriodicityTrack.h"
+#include <algorithm>
+
+/** ***************************************
+PeriodicityTrack holds the 3-mer periodicity score that RepeatMap draws as a bar
+next to the graph.  At scale 1 RepeatMap gets this score straight out of the
+visible rows of freq, but above scale 1 those rows no longer compare nucleotides.
+Instead, the whole sequence is scanned once on a worker thread.
+
+The score of a line is a weighted sum of match rates at offsets 1-60, +1 for
+multiples of 3 and -0.5 for everything else (see RepeatMap::convolution_3mer()).
+Because that is linear in the matches, it can be summed per nucleotide and then
+over any range.  The scan stores sums over fixed windows of 64bp, then each level
+above it sums pairs of the level below.  A lookup uses the coarsest level that
+still has a few windows per line, so it costs the same at every scale.
+*******************************************/
+
+PeriodicityTrack::PeriodicityTrack(QObject* parent)
+    :QObject(parent)
+{
+    sequence = NULL;
+    cancelled = false;
+    ready = false;
+    for(int i = 0; i < reach + 1; ++i)
+    {
+        if(i % 3 == 0)
+            mask[i] = 1.0;
+        else
+            mask[i] = -0.5;
+    }
+    connect(&watcher, SIGNAL(finished()), this, SLOT(scanFinished()));
+}
+
+PeriodicityTrack::~PeriodicityTrack()
+{
+    cancel();
+}
+
+/** Starts a background scan of seq, unless one is already running or done for it. */
+void PeriodicityTrack::scan(const string* seq)
+{
+    if(seq == NULL)
+        return;
+    if(seq == sequence && (ready || future.isRunning()))
+        return;
+    cancel();
+    sequence = seq;
+    cancelled = false;
+    future = QtConcurrent::run(this, &PeriodicityTrack::scanWindows);
+    watcher.setFuture(future);
+}
+
+/** Blocks until the worker has stopped.  This has to happen before the sequence changes. */
+void PeriodicityTrack::cancel()
+{
+    cancelled = true;
+    future.waitForFinished();
+    ready = false;
+    levels.clear();
+    sequence = NULL;
+}
+
+bool PeriodicityTrack::isReady()
+{
+    return ready;
+}
+
+/** Average per nucleotide score over [start, start+length).  Partial windows at the
+  edges are counted in proportion to their overlap. */
+float PeriodicityTrack::score(int start, int length)
+{
+    if(!ready || levels.empty() || length < 1)
+        return 0.0;
+
+    int level = 0;
+    while(level + 1 < (int)levels.size() && ((qint64)windowSize << (level + 1)) * 4 <= length)
+        ++level;
+    const vector<float>& sums = levels[level];
+    int window = windowSize << level;
+
+    int end = start + length;
+    double total = 0.0;
+    for(int w = max(0, start / window); w < (int)sums.size() && w * window < end; ++w)
+    {
+        int overlap = min(end, (w + 1) * window) - max(start, w * window);
+        total += sums[w] * overlap / window;
+    }
+    return total / length;
+}
+
+void PeriodicityTrack::scanFinished()
+{
+    if(cancelled || sequence == NULL)
+        return;
+    ready = true;
+    emit trackReady();
+}
+
+/** Runs on the worker thread.  levels is only read once scanFinished() has run. */
+void PeriodicityTrack::scanWindows()
+{
+    int size = sequence->size();
+    int windows = (size + windowSize - 1) / windowSize;
+    vector< vector<float> > pyramid(1, vector<float>(windows, 0.0));
+    for(int w = 0; w < windows; ++w)
+    {
+        if(cancelled)
+            return;
+        pyramid[0][w] = windowSum(w * windowSize, min(size, (w + 1) * windowSize));
+    }
+
+    while(pyramid.back().size() > 1)
+    {
+        const vector<float>& below = pyramid.back();
+        vector<float> above((below.size() + 1) / 2, 0.0);
+        for(int i = 0; i < (int)below.size(); ++i)
+            above[i / 2] += below[i];
+        pyramid.push_back(above);
+    }
+    levels.swap(pyramid);
+}
+
+/** Sum of the per nucleotide scores in [begin, end).  The inner loop walks one offset at
+  a time so it stays a straight compare and count. */
+float PeriodicityTrack::windowSum(int begin, int end)
+{
+    const char* genome = sequence->c_str();
+    int size = sequence->size();
+    float sum = 0.0;
+    for(int x = 1; x <= reach; ++x)
+    {
+        int last = min(end, size - x);
+        int matches = 0;
+        for(int i = begin; i < last; ++i)
+            matches += (genome[i] == genome[i + x]);
+        sum += mask[x] * matches;
+    }
+    return sum;
+}
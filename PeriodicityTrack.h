@@ -0,0 +1,51 @@
+#ifndef PERIODICITY_TRACK
+#define PERIODICITY_TRACK
+
+#include <string>
+#include <vector>
+#include <QObject>
+#include <QFuture>
+#include <QFutureWatcher>
+#include <qtconcurrentrun.h>
+
+using namespace std;
+
+/**
+*  Whole sequence 3-mer (codon) periodicity scores, computed once on a worker thread
+*  and stored as a pyramid of window sums so that any range can be looked up quickly.
+*/
+class PeriodicityTrack : public QObject
+{
+    Q_OBJECT
+
+public:
+    PeriodicityTrack(QObject* parent = 0);
+    ~PeriodicityTrack();
+    void scan(const string* seq);
+    void cancel();
+    bool isReady();
+    float score(int start, int length);
+
+    static const int reach = 20 * 3;
+    static const int windowSize = 64;
+
+signals:
+    void trackReady();
+
+private slots:
+    void scanFinished();
+
+private:
+    void scanWindows();
+    float windowSum(int begin, int end);
+
+    const string* sequence;
+    volatile bool cancelled;
+    bool ready;
+    float mask[reach + 1];
+    vector< vector<float> > levels;//levels[k] holds sums over windowSize << k nucleotides
+    QFuture<void> future;
+    QFutureWatcher<void> watcher;
+};
+
+#endif
@@ -0,0 +1,497 @@
+#include "RegexDfa.h"
+#include "SkittleUtil.h"
+#include <algorithm>
+#include <map>
+
+/** ***************************************
+RegexDfa is the "Regular Expressions" mode of the Sequence Highlighter, for structural
+motifs that a fixed query can't spell out: a G-quadruplex is
+G{3,}N{1,7}G{3,}N{1,7}G{3,}N{1,7}G{3,}, an E-box is CANNTG, and a restriction site
+with a spacer is something like GCCN{5}GGC.  The syntax is the usual one: letters are
+A, C, G, T or an IUPAC code, . is any base, [ ] and [^ ] are classes, ( ) groups, |
+alternates, and * + ? {m} {m,} {m,n} repeat.  Letters other than A, C, G and T in the
+text, such as N runs, never match anything.
+
+compile() parses the expression into a tree, builds a Thompson NFA from it, and turns
+that into a DFA by subset construction.  There are two: one for the expression with
+".*" in front, which reaches an accepting state at every position where a match ends,
+and one for the expression backwards, which is run back from each of those ends to find
+the start of the longest match.  With reverseComplement, both also take the reverse
+complement of the expression, which is the same tree read backwards with the bases
+complemented, so both strands are found in the same pass.
+
+scan() is one lookup in the forward table per nucleotide.  The ends are written to a
+buffer unconditionally and the count only advances on accepting states, so the loop has
+no branch that depends on the text.
+*******************************************/
+
+static const int nfaLimit = 200000;//NFA states before an expression is refused
+static const int scanBlockSize = 4096;//match ends buffered before their starts are found
+
+static inline int complementMask(int mask)
+{
+    return ((mask & 1) << 3) | ((mask & 8) >> 3) | ((mask & 2) << 1) | ((mask & 4) >> 1);
+}
+
+RegexDfa::RegexDfa()
+{
+    for(int c = 0; c < 256; ++c)
+        code[c] = 4;
+    code[(unsigned char)'A'] = 0;
+    code[(unsigned char)'C'] = 1;
+    code[(unsigned char)'G'] = 2;
+    code[(unsigned char)'T'] = 3;
+    cursor = 0;
+    compiled = false;
+    reachLength = 0;
+}
+
+/** Returns false, with the reason in error, if expression can't be read, matches an
+  empty sequence, or needs more than stateLimit DFA states. */
+bool RegexDfa::compile(const string& expression, bool reverseComplement, string& error)
+{
+    compiled = false;
+    source = expression;
+    cursor = 0;
+    problem.clear();
+    nodes.clear();
+    int root = parseAlternation();
+    if(problem.empty() && cursor < (int)source.size())
+        problem = "unmatched )";
+    if(problem.empty())
+    {
+        reachLength = longest(root);
+
+        nfa.clear();
+        int start = addState();
+        int accept = addState();
+        for(int strand = 0; strand < (reverseComplement ? 2 : 1); ++strand)
+        {
+            Fragment f = build(root, strand == 1, strand == 1);
+            nfa[start].epsilon.push_back(f.start);
+            nfa[f.end].epsilon.push_back(accept);
+        }
+        if((int)nfa.size() > nfaLimit || !determinize(start, accept, true, forward, forwardAccepting))
+            problem = "too many states";
+        else if(forwardAccepting[1])
+            problem = "matches an empty sequence";
+    }
+    if(problem.empty())
+    {
+        nfa.clear();
+        int start = addState();
+        int accept = addState();
+        for(int strand = 0; strand < (reverseComplement ? 2 : 1); ++strand)
+        {
+            Fragment f = build(root, strand == 0, strand == 1);
+            nfa[start].epsilon.push_back(f.start);
+            nfa[f.end].epsilon.push_back(accept);
+        }
+        if(!determinize(start, accept, false, backward, backwardAccepting))
+            problem = "too many states";
+    }
+    nodes.clear();
+    nfa.clear();
+    seen.clear();
+    if(!problem.empty())
+    {
+        error = problem;
+        forward.clear();
+        backward.clear();
+        return false;
+    }
+    compiled = true;
+    return true;
+}
+
+bool RegexDfa::isCompiled()
+{
+    return compiled;
+}
+
+/** The longest a match can be, or unboundedReach if it has no limit. */
+int RegexDfa::reach()
+{
+    return reachLength;
+}
+
+/** Appends every position in text where a match ends, with the start of the longest match
+  ending there, in order of where they end.  Matches have to lie wholly inside text. */
+void RegexDfa::scan(const char* text, int length, vector<MotifHit>& hits)
+{
+    if(!compiled)
+        return;
+    const int* table = &forward[0];
+    const int* accepting = &forwardAccepting[0];
+    int ends[scanBlockSize];
+    int state = 1;
+    for(int block = 0; block < length; block += scanBlockSize)
+    {
+        int blockEnd = min(length, block + scanBlockSize);
+        int found = 0;
+        for(int j = block; j < blockEnd; ++j)
+        {
+            state = table[state * symbols + code[(unsigned char)text[j]]];
+            ends[found] = j;
+            found += accepting[state];
+        }
+        for(int k = 0; k < found; ++k)
+        {
+            MotifHit hit;
+            hit.start = matchStart(text, ends[k]);
+            hit.end = ends[k];
+            hits.push_back(hit);
+        }
+    }
+}
+
+/** Runs the backward DFA from end until it dies, remembering the last accepting state. */
+int RegexDfa::matchStart(const char* text, int end)
+{
+    int limit = max(0, end - reachLength + 1);
+    int state = 1;
+    int start = end;
+    for(int i = end; i >= limit; --i)
+    {
+        state = backward[state * symbols + code[(unsigned char)text[i]]];
+        if(state == 0)
+            break;
+        if(backwardAccepting[state])
+            start = i;
+    }
+    return start;
+}
+
+int RegexDfa::addNode(NodeType type, int mask)
+{
+    Node node;
+    node.type = type;
+    node.mask = mask;
+    node.low = 0;
+    node.high = 0;
+    nodes.push_back(node);
+    return nodes.size() - 1;
+}
+
+int RegexDfa::parseAlternation()
+{
+    int first = parseConcatenation();
+    if(!problem.empty() || cursor >= (int)source.size() || source[cursor] != '|')
+        return first;
+    int node = addNode(Alternation, 0);
+    nodes[node].children.push_back(first);
+    while(problem.empty() && cursor < (int)source.size() && source[cursor] == '|')
+    {
+        ++cursor;
+        int next = parseConcatenation();
+        nodes[node].children.push_back(next);
+    }
+    return node;
+}
+
+int RegexDfa::parseConcatenation()
+{
+    int node = addNode(Concatenation, 0);
+    while(problem.empty() && cursor < (int)source.size() && source[cursor] != '|' && source[cursor] != ')')
+    {
+        int part = parseRepeat();
+        nodes[node].children.push_back(part);
+    }
+    return node;
+}
+
+int RegexDfa::parseRepeat()
+{
+    int node = parseAtom();
+    while(problem.empty() && cursor < (int)source.size())
+    {
+        int low = 0;
+        int high = -1;
+        char c = source[cursor];
+        if(c == '+')
+            low = 1;
+        else if(c == '?')
+            high = 1;
+        else if(c == '{')
+        {
+            ++cursor;
+            if(!parseNumber(low))
+                return node;
+            high = low;
+            if(cursor < (int)source.size() && source[cursor] == ',')
+            {
+                ++cursor;
+                if(cursor < (int)source.size() && source[cursor] == '}')
+                    high = -1;
+                else if(!parseNumber(high))
+                    return node;
+            }
+            if(cursor >= (int)source.size() || source[cursor] != '}')
+            {
+                problem = "missing }";
+                return node;
+            }
+            if(high >= 0 && high < low)
+            {
+                problem = "{m,n} with n less than m";
+                return node;
+            }
+        }
+        else if(c != '*')
+            break;
+        ++cursor;
+        int repeat = addNode(Repeat, 0);
+        nodes[repeat].low = low;
+        nodes[repeat].high = high;
+        nodes[repeat].children.push_back(node);
+        node = repeat;
+    }
+    return node;
+}
+
+int RegexDfa::parseAtom()
+{
+    char c = source[cursor];
+    if(c == '(')
+    {
+        ++cursor;
+        int inner = parseAlternation();
+        if(problem.empty() && (cursor >= (int)source.size() || source[cursor] != ')'))
+            problem = "missing )";
+        ++cursor;
+        return inner;
+    }
+    if(c == '[')
+        return parseClass();
+    int mask = (c == '.') ? 15 : iupacMask(c);
+    if(mask == 0)
+    {
+        problem = string("unexpected ") + c;
+        return addNode(Concatenation, 0);
+    }
+    ++cursor;
+    return addNode(Letter, mask);
+}
+
+/** [ACG] matches any of the letters inside, [^ACG] any base that none of them match. */
+int RegexDfa::parseClass()
+{
+    ++cursor;
+    bool negated = cursor < (int)source.size() && source[cursor] == '^';
+    if(negated)
+        ++cursor;
+    int mask = 0;
+    while(cursor < (int)source.size() && source[cursor] != ']')
+    {
+        int bases = iupacMask(source[cursor]);
+        if(bases == 0)
+        {
+            problem = string("unexpected ") + source[cursor] + " in [ ]";
+            return addNode(Concatenation, 0);
+        }
+        mask |= bases;
+        ++cursor;
+    }
+    if(cursor >= (int)source.size())
+    {
+        problem = "missing ]";
+        return addNode(Concatenation, 0);
+    }
+    ++cursor;
+    if(negated)
+        mask = ~mask & 15;
+    if(mask == 0)
+    {
+        problem = "[ ] that matches nothing";
+        return addNode(Concatenation, 0);
+    }
+    return addNode(Letter, mask);
+}
+
+bool RegexDfa::parseNumber(int& number)
+{
+    number = 0;
+    int digits = 0;
+    while(cursor < (int)source.size() && source[cursor] >= '0' && source[cursor] <= '9')
+    {
+        number = min(number * 10 + (source[cursor] - '0'), repeatLimit + 1);
+        ++digits;
+        ++cursor;
+    }
+    if(digits == 0)
+        problem = "expected a number in { }";
+    else if(number > repeatLimit)
+        problem = "repeat count over 1000";
+    return problem.empty();
+}
+
+/** Longest match of node, capped at unboundedReach. */
+int RegexDfa::longest(int node)
+{
+    const Node& n = nodes[node];
+    int length = 0;
+    if(n.type == Letter)
+        length = 1;
+    else if(n.type == Concatenation)
+    {
+        for(int i = 0; i < (int)n.children.size(); ++i)
+            length = min(unboundedReach, length + longest(n.children[i]));
+    }
+    else if(n.type == Alternation)
+    {
+        for(int i = 0; i < (int)n.children.size(); ++i)
+            length = max(length, longest(n.children[i]));
+    }
+    else
+    {
+        int child = longest(n.children[0]);
+        if(child > 0)
+            length = (n.high < 0) ? unboundedReach : min(unboundedReach, n.high * child);
+    }
+    return length;
+}
+
+int RegexDfa::addState()
+{
+    NfaState state;
+    state.mask = 0;
+    state.next = -1;
+    nfa.push_back(state);
+    return nfa.size() - 1;
+}
+
+/** Thompson's construction.  reversed reads every concatenation backwards, and
+  complemented swaps A with T and C with G. */
+RegexDfa::Fragment RegexDfa::build(int node, bool reversed, bool complemented)
+{
+    Fragment f;
+    f.start = addState();
+    f.end = f.start;
+    if((int)nfa.size() > nfaLimit)
+        return f;
+    const Node& n = nodes[node];
+    if(n.type == Letter)
+    {
+        f.end = addState();
+        nfa[f.start].mask = complemented ? complementMask(n.mask) : n.mask;
+        nfa[f.start].next = f.end;
+    }
+    else if(n.type == Concatenation)
+    {
+        for(int i = 0; i < (int)n.children.size(); ++i)
+        {
+            int child = reversed ? n.children[n.children.size() - 1 - i] : n.children[i];
+            Fragment part = build(child, reversed, complemented);
+            nfa[f.end].epsilon.push_back(part.start);
+            f.end = part.end;
+        }
+    }
+    else if(n.type == Alternation)
+    {
+        f.end = addState();
+        for(int i = 0; i < (int)n.children.size(); ++i)
+        {
+            Fragment part = build(n.children[i], reversed, complemented);
+            nfa[f.start].epsilon.push_back(part.start);
+            nfa[part.end].epsilon.push_back(f.end);
+        }
+    }
+    else
+    {
+        int current = f.start;
+        for(int i = 0; i < n.low && (int)nfa.size() <= nfaLimit; ++i)
+        {
+            Fragment part = build(n.children[0], reversed, complemented);
+            nfa[current].epsilon.push_back(part.start);
+            current = part.end;
+        }
+        f.end = addState();
+        nfa[current].epsilon.push_back(f.end);
+        if(n.high < 0)
+        {
+            Fragment part = build(n.children[0], reversed, complemented);
+            nfa[current].epsilon.push_back(part.start);
+            nfa[part.end].epsilon.push_back(part.start);
+            nfa[part.end].epsilon.push_back(f.end);
+        }
+        for(int i = n.low; i < n.high && (int)nfa.size() <= nfaLimit; ++i)
+        {//each optional copy can be the last
+            Fragment part = build(n.children[0], reversed, complemented);
+            nfa[current].epsilon.push_back(part.start);
+            current = part.end;
+            nfa[current].epsilon.push_back(f.end);
+        }
+    }
+    return f;
+}
+
+/** Replaces states with the sorted set of states reachable from them by empty moves.
+  Only states that read a base, and accept, are kept: the rest never change what a DFA
+  state does, and leaving them out lets more subsets share a DFA state. */
+void RegexDfa::closure(vector<int>& states, int accept)
+{
+    vector<int> stack(states);
+    states.clear();
+    vector<int> visited;
+    while(!stack.empty())
+    {
+        int q = stack.back();
+        stack.pop_back();
+        if(seen[q])
+            continue;
+        seen[q] = 1;
+        visited.push_back(q);
+        if(nfa[q].mask != 0 || q == accept)
+            states.push_back(q);
+        for(int i = 0; i < (int)nfa[q].epsilon.size(); ++i)
+            if(!seen[nfa[q].epsilon[i]])
+                stack.push_back(nfa[q].epsilon[i]);
+    }
+    for(int i = 0; i < (int)visited.size(); ++i)
+        seen[visited[i]] = 0;
+    sort(states.begin(), states.end());
+}
+
+/** Subset construction.  State 0 of the table is dead and state 1 is the start.  An
+  unanchored DFA goes back through start after every base, so a match can begin
+  anywhere. */
+bool RegexDfa::determinize(int start, int accept, bool unanchored, vector<int>& table, vector<int>& accepting)
+{
+    seen.assign(nfa.size(), 0);
+    map<vector<int>, int> ids;
+    vector<const vector<int>*> sets;
+    vector<int> initial(1, start);
+    closure(initial, accept);
+    sets.push_back(&ids.insert(make_pair(vector<int>(), 0)).first->first);
+    sets.push_back(&ids.insert(make_pair(initial, 1)).first->first);
+    table.clear();
+    accepting.clear();
+    for(int s = 0; s < (int)sets.size(); ++s)
+    {
+        const vector<int>& current = *sets[s];
+        for(int symbol = 0; symbol < symbols; ++symbol)
+        {
+            vector<int> next;
+            if(s != 0 || unanchored)
+            {
+                for(int i = 0; i < (int)current.size(); ++i)
+                    if(nfa[current[i]].mask & (1 << symbol))
+                        next.push_back(nfa[current[i]].next);
+                if(unanchored)
+                    next.push_back(start);
+                closure(next, accept);
+            }
+            map<vector<int>, int>::iterator found = ids.find(next);
+            if(found == ids.end())
+            {
+                if((int)sets.size() >= stateLimit)
+                    return false;
+                found = ids.insert(make_pair(next, (int)sets.size())).first;
+                sets.push_back(&found->first);
+            }
+            table.push_back(found->second);
+        }
+        accepting.push_back(binary_search(current.begin(), current.end(), accept) ? 1 : 0);
+    }
+    return true;
+}
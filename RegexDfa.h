@@ -0,0 +1,84 @@
+#ifndef REGEX_DFA
+#define REGEX_DFA
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct MotifHit
+{
+    int start;//index in the text of the first nucleotide
+    int end;//index in the text of the last nucleotide
+};
+
+/**
+*  A regular expression over A, C, G, T and the IUPAC codes, compiled into a DFA
+*  transition table so that a text is searched with one table lookup per nucleotide.
+*/
+class RegexDfa
+{
+public:
+    RegexDfa();
+    bool compile(const string& expression, bool reverseComplement, string& error);
+    bool isCompiled();
+    int reach();
+    void scan(const char* text, int length, vector<MotifHit>& hits);
+
+    static const int symbols = 5;//A, C, G, T and anything else
+    static const int stateLimit = 50000;//DFA states before an expression is refused
+    static const int repeatLimit = 1000;//largest count allowed in {m,n}
+    static const int unboundedReach = 4096;//how far back a match with * or + is followed
+
+private:
+    enum NodeType { Letter, Concatenation, Alternation, Repeat };
+    struct Node//of the parse tree
+    {
+        NodeType type;
+        int mask;//bases a Letter matches, A=1 C=2 G=4 T=8
+        int low;//Repeat counts, high is -1 for no limit
+        int high;
+        vector<int> children;
+    };
+    struct NfaState
+    {
+        int mask;//bases that lead to next
+        int next;
+        vector<int> epsilon;
+    };
+    struct Fragment
+    {
+        int start;
+        int end;
+    };
+
+    int addNode(NodeType type, int mask);
+    int parseAlternation();
+    int parseConcatenation();
+    int parseRepeat();
+    int parseAtom();
+    int parseClass();
+    bool parseNumber(int& number);
+    int longest(int node);
+    int addState();
+    Fragment build(int node, bool reversed, bool complemented);
+    void closure(vector<int>& states, int accept);
+    bool determinize(int start, int accept, bool unanchored, vector<int>& table, vector<int>& accepting);
+    int matchStart(const char* text, int end);
+
+    unsigned char code[256];//symbol of each text letter
+    string source;
+    int cursor;
+    string problem;
+    vector<Node> nodes;
+    vector<NfaState> nfa;
+    vector<char> seen;//closure() scratch, one per NFA state
+    bool compiled;
+    int reachLength;
+    vector<int> forward;//unanchored, finds where matches end
+    vector<int> forwardAccepting;
+    vector<int> backward;//anchored on the reversed expression, finds where they start
+    vector<int> backwardAccepting;
+};
+
+#endif
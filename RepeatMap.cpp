@@ -2,7 +2,11 @@
 #include "glwidget.h"
 #include "SkittleUtil.h"
 #include <sstream>
+#include <algorithm>
 #include <QFrame>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 
 /** ***************************************
 RepeatMap is designed to make finding tandem repeats much easier than randomly
@@ -38,7 +42,29 @@ of scale.  The size of repeats it is scanning for is proportional to the number
 This change in behavior requires a change in the equivalence check, since no two stretches of
 1,000bp are exactly the same.  Instead, RepeatMap uses a correlation score between the two RGB
 values using: double correlate().  This is the same method as above, but more mathematically
-sophisticated.
+sophisticated.  The per channel sums and sums of squares come from running sums built once
+per frame by loadPlanarColors(), so only the cross terms are computed for each pixel.
+
+For very large offset ranges (F_start in the tens of thousands, or a wide graph), the
+direct equivalence check costs one pass over the line for every column.  The optional
+FFT mode computes every column of a line at once with FftCorrelator, O(n log n) per line.
+In FFT mode N's never match anything, so unsequenced regions are dark instead of white.
+
+Scrolling vertically by whole lines only exposes a few new lines at the top or bottom.
+freq is a ring of lines: scrollComputedRows() moves the top of the ring and only the
+newly exposed lines are scored.  Everything else about the view has to be unchanged.
+The texture is scrolled the same way by scroll_canvas(), so only the new lines are
+uploaded to the card, and the canvas is only rebuilt when the scores change.
+
+The 3-mer bar on the left is computed from freq at scale 1.  At every other scale it
+is read from a PeriodicityTrack, a whole sequence scan that runs in the background.
+
+Inverted repeats (hairpins, palindromes) are invisible to a forward comparison.  In
+reverse complement mode each line is compared to the reverse complement of the
+sequence starting at each offset, so the two arms of an inverted repeat make a white
+pixel in the column of their distance.  This mode works on nucleotides at every scale
+and uses a PackedSequence of the visible region with both strands packed, so a
+comparison is an XOR and popcount per 32 nucleotides.
 *******************************************/
 RepeatMap::RepeatMap(UiVariables* gui, GLWidget* gl)
     :AbstractGraph(gui, gl)
@@ -50,14 +76,22 @@ RepeatMap::RepeatMap(UiVariables* gui, GLWidget* gl)
     F_start = 1;
     F_height = 1;
     using3merGraph = true;
-
-    freq = vector< vector<float> >();
-    for(int i = 0; i < 400; i++)
-    {
-        freq.push_back( vector<float>(F_width, 0.0) );
-    }
+    usingFftCorrelation = false;
+    usingReverseComplement = false;
+
+    freqBuffer = NULL;
+    freq = NULL;
+    freqStride = 0;
+    freqRows = 0;
+    freqCapacity = 0;
+    ringHead = 0;
+    hasComputedRows = false;
+    resizeFreq(400);
     freq_map_count = 0;
     calculate_count = 0;
+    scoreCache.setMaxCost(64 * 1024);//costs are in KB
+
+    connect(&periodicity, SIGNAL(trackReady()), this, SLOT(invalidate()));
 
     actionLabel = string("Repeat Map");
     actionTooltip = string("Graph of possible alignmments");
@@ -66,8 +100,10 @@ RepeatMap::RepeatMap(UiVariables* gui, GLWidget* gl)
 
 RepeatMap::~RepeatMap()
 {
+    periodicity.cancel();
     if(canvas_3mer != NULL)
         delete canvas_3mer;
+    delete [] freqBuffer;
 }
 
 QScrollArea* RepeatMap::settingsUi()
@@ -90,7 +126,7 @@ QScrollArea* RepeatMap::settingsUi()
     
     QSpinBox* graphWidthDial  = new QSpinBox(settingsTab);
     graphWidthDial->setMinimum(1);
-    graphWidthDial->setMaximum(500);
+    graphWidthDial->setMaximum(TextureCanvas::maxSaneWidth);
     graphWidthDial->setSingleStep(10);
     graphWidthDial->setValue(F_width);
     formLayout->addRow("Graph Display Width:", graphWidthDial);
@@ -104,6 +140,27 @@ QScrollArea* RepeatMap::settingsUi()
     formLayout->addRow("Find 3mer pattern", find3merButton);
     connect( find3merButton, SIGNAL(toggled(bool)), this, SLOT(toggle3merGraph(bool)));
 
+    QCheckBox* fftButton = new QCheckBox(settingsTab);
+    fftButton->setChecked(usingFftCorrelation);
+    fftButton->setToolTip("Faster for large Starting Offsets and Graph Widths");
+    formLayout->addRow("Use FFT correlation", fftButton);
+    connect( fftButton, SIGNAL(toggled(bool)), this, SLOT(toggleFftCorrelation(bool)));
+
+    QCheckBox* reverseButton = new QCheckBox(settingsTab);
+    reverseButton->setChecked(usingReverseComplement);
+    reverseButton->setToolTip("Compare each line to the reverse complement to find inverted repeats");
+    formLayout->addRow("Reverse complement", reverseButton);
+    connect( reverseButton, SIGNAL(toggled(bool)), this, SLOT(toggleReverseComplement(bool)));
+
+    QSpinBox* cacheSizeDial = new QSpinBox(settingsTab);
+    cacheSizeDial->setMinimum(0);
+    cacheSizeDial->setMaximum(4096);
+    cacheSizeDial->setSingleStep(16);
+    cacheSizeDial->setSuffix(" MB");
+    cacheSizeDial->setValue(scoreCache.maxCost() / 1024);
+    formLayout->addRow("Result Cache Size:", cacheSizeDial);
+    connect( cacheSizeDial, SIGNAL(valueChanged(int)), this, SLOT(changeCacheSize(int)));
+
     return settingsTab;
 }
 
@@ -111,33 +168,61 @@ void RepeatMap::display()
 {
     checkVariables();
 
+    bool rescored = !upToDate;
+    int scrolledLines = 0;
+    int firstRow = 0;
+    int lastRow = 0;
     if( !upToDate )
     {
-        if((ui->getScale() > 1)&& nuc != NULL)
+        RepeatMapKey key = currentKey();
+        if( !loadCachedScores(key) )
         {
-            nuc->checkVariables();
-            if(!nuc->upToDate)
+            lastRow = height();
+            if( !scrollComputedRows(key, firstRow, lastRow, scrolledLines) )
+                resizeFreq(lastRow);
+            if(usingReverseComplement)
             {
-                nuc->calculateOutputPixels();
+                reverse_freq_map(firstRow, lastRow);
             }
-            int displayWidth = ui->getWidth() / ui->getScale();
-            calculate(nuc->outputPixels, displayWidth);
-        }
-        else
-        {
-            freq_map();
-            if(using3merGraph && ui->getScale() == 1)
+            else if((ui->getScale() > 1)&& nuc != NULL)
             {
-                vector<float> scores_3mer = convolution_3mer();
-                vector<float> smoothed_scores = lowPassFilter(scores_3mer);
-                load_3mer_canvas(smoothed_scores);
+                nuc->checkVariables();
+                if(!nuc->upToDate)
+                {
+                    nuc->calculateOutputPixels();
+                }
+                int displayWidth = ui->getWidth() / ui->getScale();
+                calculate(nuc->outputPixels, displayWidth, firstRow, lastRow);
+            }
+            else
+            {
+                freq_map(firstRow, lastRow);
             }
+            storeCachedScores(key);
+        }
+        computedKey = key;
+        hasComputedRows = true;
+        if(using3merGraph && !convolving3mer())
+            periodicity.scan(sequence);//no-op once it's running or done
+        if(showing3merGraph())
+        {
+            vector<float> scores_3mer;
+            if(convolving3mer())
+                scores_3mer = convolution_3mer();
+            else
+                scores_3mer = lookup_3mer();
+            vector<float> smoothed_scores = lowPassFilter(scores_3mer);
+            load_3mer_canvas(smoothed_scores);
         }
     }
-    load_canvas();
+    if(rescored || textureBuffer == NULL)
+    {
+        if(scrolledLines == 0 || !scroll_canvas(scrolledLines, firstRow, lastRow))
+            load_canvas();
+    }
     glPushMatrix();
     glScaled(1,-1,1);
-    if(using3merGraph && ui->getScale() == 1)// && canvas_3mer != NULL)
+    if(showing3merGraph() && canvas_3mer != NULL)
     {
         canvas_3mer->display();
         glTranslated(barWidth+spacerWidth, 0, 0);
@@ -177,11 +262,14 @@ void RepeatMap::link(NucleotideDisplay* nuc_display)
 void RepeatMap::load_canvas()
 {
     outputPixels.clear();
-    for( int h = 0; h < height(); h++)
+    int rows = min(height(), freqRows);
+    outputPixels.reserve(rows * F_width + F_width + 1);//TextureCanvas pads one more line
+    for( int h = 0; h < rows; h++)
     {
+        const float* row = freqRow(h);
         for(int w = 1; w <= F_width; w++)
         {
-            int grey = static_cast<int>(  freq[h][w] * 255 );
+            int grey = static_cast<int>(  row[w] * 255 );
             outputPixels.push_back( color(grey, grey, grey) );
         }
     }
@@ -190,6 +278,32 @@ void RepeatMap::load_canvas()
     upToDate = true;
 }
 
+/** After scrollComputedRows(), the texture is scrolled by lines instead of uploaded
+  again, and only the rows [firstRow, lastRow) that came into view are sent to the card.
+  outputPixels is kept in screen order.  Returns false if the canvas has to be rebuilt. */
+bool RepeatMap::scroll_canvas(int lines, int firstRow, int lastRow)
+{
+    int rows = min(height(), freqRows);
+    if(textureBuffer == NULL || (int)outputPixels.size() < (rows + 1) * F_width
+            || !textureBuffer->scrollRows(lines, rows))
+        return false;
+    vector<color>::iterator top = outputPixels.begin();
+    int shift = ((lines % rows) + rows) % rows;
+    rotate(top, top + shift * F_width, top + rows * F_width);
+    for( int h = firstRow; h < lastRow; h++)
+    {
+        const float* row = freqRow(h);
+        for(int w = 1; w <= F_width; w++)
+        {
+            int grey = static_cast<int>(  row[w] * 255 );
+            outputPixels[h * F_width + w-1] = color(grey, grey, grey);
+        }
+    }
+    textureBuffer->replaceRows(&outputPixels[firstRow * F_width], firstRow, lastRow - firstRow);
+    upToDate = true;
+    return true;
+}
+
 void RepeatMap::calculateOutputPixels()
 {
     freq_map();
@@ -215,11 +329,24 @@ GLuint RepeatMap::render()
 }
 
 void RepeatMap::freq_map()
+{
+    resizeFreq(height());
+    freq_map(0, height());
+    hasComputedRows = false;//not recorded by display(), so don't scroll from it
+}
+
+/** Scores lines [firstRow, lastRow) of the current view into freq. */
+void RepeatMap::freq_map(int firstRow, int lastRow)
 {
     qDebug() << "Width: " << ui->getWidth() << "\nScale: " << ui->getScale() << "\nStart: " << ui->getStart(glWidget);
 
     const char* genome = sequence->c_str() + ui->getStart(glWidget);//TODO: find a safer way to access this
-    for( int h = 0; h < height(); h++)
+    if(usingFftCorrelation)
+    {
+        fft_freq_map(genome, firstRow, lastRow);
+        return;
+    }
+    for( int h = firstRow; h < lastRow; h++)
     {
         int tempWidth = ui->getWidth();
         int offset = h * tempWidth;
@@ -234,6 +361,7 @@ void RepeatMap::freq_map()
         {*/
         /** This is the core algorithm of RepeatMap.  For each line, for each width,
           check the line below and see if it matches.         */
+        float* row = freqRow(h);
         for(int w = 1; w <= F_width; w++)//calculate across widths 1-F_width
         {
             int score = 0;
@@ -242,12 +370,61 @@ void RepeatMap::freq_map()
                 if(genome[offset + line_length] == genome[offset + w + (F_start-1) + line_length])
                     score += 1; //pixel matches the one above it
             }
-            freq[h][w] = float(score) / tempWidth;
+            row[w] = float(score) / tempWidth;
         }
     }
     upToDate = true;
 }
 
+/** Scores lines [firstRow, lastRow) against the reverse complement.  Column w compares
+  a line of length L at o with the reverse complement of the L nucleotides starting d
+  further along, so line[i] pairs with complement(genome[o+d+L-1-i]).  On the packed
+  reverse strand of a region of size n, that's position n-o-d-L+i. */
+void RepeatMap::reverse_freq_map(int firstRow, int lastRow)
+{
+    int start = ui->getStart(glWidget);
+    int lineLength = ui->getWidth();
+    int scale = ui->getScale();
+    int reach = (F_width - 1) * scale + F_start + lineLength;
+    int regionLength = min((int)sequence->size() - start, lastRow * lineLength + reach);
+    packedView.pack(sequence->c_str() + start, max(0, regionLength), true);
+    int n = packedView.size();
+
+    for( int h = firstRow; h < lastRow; h++)
+    {
+        int offset = h * lineLength;
+        float* row = freqRow(h);
+        for(int w = 1; w <= F_width; w++)
+        {
+            int distance = (w - 1) * scale + F_start;
+            int reverseStart = n - offset - distance - lineLength;
+            if(offset + lineLength > n || reverseStart < 0)
+                row[w] = 0.0;
+            else
+                row[w] = float(packedView.reverseMatches(offset, reverseStart, lineLength)) / lineLength;
+        }
+    }
+    upToDate = true;
+}
+
+/** Same result as the core loop of freq_map() (except for N's), but all F_width offsets
+  of a line come out of one FFT.  The target starts at F_start and spans the line
+  plus every offset. */
+void RepeatMap::fft_freq_map(const char* genome, int firstRow, int lastRow)
+{
+    int tempWidth = ui->getWidth();
+    vector<float> counts;
+    for( int h = firstRow; h < lastRow; h++)
+    {
+        int offset = h * tempWidth;
+        fftCorrelator.matchCounts(genome + offset, tempWidth, genome + offset + F_start, F_width, counts);
+        float* row = freqRow(h);
+        for(int w = 1; w <= F_width; w++)
+            row[w] = counts[w-1] / tempWidth;
+    }
+    upToDate = true;
+}
+
 vector<float> RepeatMap::convolution_3mer()
 {
     int reach = 20 * 3;
@@ -260,12 +437,14 @@ vector<float> RepeatMap::convolution_3mer()
             mask.push_back(-0.5);
     }
     vector<float> scores;
-    for(int y = 0; y < (int)freq.size(); ++y)
+    int rows = min(height(), freqRows);
+    for(int y = 0; y < rows; ++y)
     {
+        const float* row = freqRow(y);
         float lineScore = 0.0;
-        for(int x = 1; x < (int)mask.size() && x < (int)freq[y].size(); ++x)//we start at 1 to skip self vs. self comparison
+        for(int x = 1; x < (int)mask.size() && x <= F_width; ++x)//we start at 1 to skip self vs. self comparison
         {
-            lineScore += mask[x] * freq[y][x];
+            lineScore += mask[x] * row[x];
             //            lineScore += min((float)0.5, mask[x] * freq[y][x]);//the amount that any position can affect is capped because of tandem repeats with 100% similarity
         }
         scores.push_back(lineScore);
@@ -273,12 +452,37 @@ vector<float> RepeatMap::convolution_3mer()
     return scores;
 }
 
+/** Same score as convolution_3mer() for each line, but from the whole sequence
+  PeriodicityTrack, so it doesn't need freq to compare nucleotides. */
+vector<float> RepeatMap::lookup_3mer()
+{
+    vector<float> scores;
+    int rows = min(height(), freqRows);
+    int start = ui->getStart(glWidget);
+    int lineLength = ui->getWidth();
+    for(int y = 0; y < rows; ++y)
+        scores.push_back(periodicity.score(start + y * lineLength, lineLength));
+    return scores;
+}
+
+/** At scale 1 the bar comes from freq.  Above that it waits for the background scan. */
+bool RepeatMap::showing3merGraph()
+{
+    return using3merGraph && (convolving3mer() || periodicity.isReady());
+}
+
+/** The 3mer mask only means something on forward nucleotide scores. */
+bool RepeatMap::convolving3mer()
+{
+    return ui->getScale() == 1 && !usingReverseComplement;
+}
+
 int RepeatMap::height()
 {
     F_height = (((long int)current_display_size()) - (F_start-1)*ui->getScale() - F_width*ui->getScale() )
             / ui->getWidth();
 
-    F_height = max(0, min(400, F_height) );
+    F_height = max(0, F_height);
 
     return F_height;
 }
@@ -294,17 +498,7 @@ void RepeatMap::changeGraphWidth(int val)
 {
     if(updateInt(F_width, val))
     {
-        //freq.clear();
-        //freq = vector< vector<float> >();
-        for(int i = 0; i < 400; i++)
-        {
-            freq[i].clear();
-        }
-        for(int i = 0; i < 400; i++)
-        {
-            freq[i] = vector<float>(F_width, 0.0) ;
-        }
-
+        resizeFreq(freqRows);//new row stride
         emit graphWidthChanged(F_width);
     }
 }	
@@ -315,23 +509,55 @@ void RepeatMap::toggle3merGraph(bool m)
     invalidate();
 }
 
+void RepeatMap::changeCacheSize(int megabytes)
+{
+    scoreCache.setMaxCost(max(0, megabytes) * 1024);
+}
+
+void RepeatMap::toggleFftCorrelation(bool f)
+{
+    usingFftCorrelation = f;
+    invalidate();
+}
+
+void RepeatMap::toggleReverseComplement(bool r)
+{
+    usingReverseComplement = r;
+    invalidate();
+}
+
 string RepeatMap::SELECT_MouseClick(point2D pt)
 {
     //range check
-    if( pt.x < (int)width() && pt.x >= 0 && pt.y <= height() )
+    if( pt.x < (int)width() && pt.x >= 0 && pt.y >= 0 && pt.y < min(height(), freqRows) )
     {
-        if(using3merGraph)
+        if(showing3merGraph())
             pt.x -= barWidth + spacerWidth;
         if(pt.x < 0)//TODO: 3mer mouseText: clicked on the 3mer detector, not freq_map
             return string();
 
-        int percentage = freq[pt.y][pt.x+1] * 100;//+1 because offset 1 is the first pixel [0]
+        if(pt.x >= F_width)
+            return string();
+        int percentage = freqRow(pt.y)[pt.x+1] * 100;//+1 because offset 1 is the first pixel [0]
         pt.x *= ui->getScale();
         int index = pt.y * ui->getWidth();
         index = index + ui->getStart(glWidget);
         int index2 = index + pt.x + F_start;
         int w = min( 100, ui->getWidth() );
-        if( index2 + w < (int)sequence->size() )
+        if(usingReverseComplement)
+        {
+            int end2 = index2 + ui->getWidth();
+            if( end2 < (int)sequence->size() )
+            {
+                stringstream ss;
+                ss << percentage << "% reverse complement similarity at Offset "<< pt.x+ F_start;
+                ss << "\nIndex: " << index << ": " << sequence->substr(index, w);
+                ss << "\nIndex: " << end2 - 1 << " (reverse complement): "
+                   << reverseComplement(sequence->substr(index2, ui->getWidth())).substr(0, w);
+                return ss.str();
+            }
+        }
+        else if( index2 + w < (int)sequence->size() )
         {
             stringstream ss;
             ss << percentage << "% similarity at Offset "<< pt.x+ F_start;
@@ -354,15 +580,17 @@ vector<point> RepeatMap::bestMatches()
     //calculate(color_avgs, width() / ui->getScale());
 
     vector<point> best_matches;
-    for(int h =0; h < height(); h++)
+    int rows = min(height(), freqRows);
+    for(int h =0; h < rows; h++)
     {
+        const float* row = freqRow(h);
         float best_score = 0;
         int best_freq = 0;
         //if(freq[h][1] != 0)//N's block
         {
             for(int w = 1; w <= F_width; w++)
             {
-                float curr = freq[h][w];
+                float curr = row[w];
                 if( curr * .90 > best_score)  //new value must beat old by at least 10%
                 {
                     best_score = curr;
@@ -376,92 +604,248 @@ vector<point> RepeatMap::bestMatches()
     return best_matches;
 }
 
-void RepeatMap::calculate(vector<color>& img, int pixelsPerSample)//constructs the frequency map
+void RepeatMap::calculate(vector<color>& img, int pixelsPerSample, int firstRow, int lastRow)//constructs the frequency map
 {
     //display_size = img.size();
     checkVariables();
     //glWidget->print("Calculate(): ", ++calculate_count);
-    for( int h = 0; h < height(); h++)
+    loadPlanarColors(img);
+    for( int h = firstRow; h < lastRow; h++)
     {
         int offset = h * pixelsPerSample;
+        float* row = freqRow(h);
         for(int w = 1; w <= F_width; w++)//calculate across widths 1-F_width
         {
-            freq[h][w] = .5 * (1.0 + correlate(img, offset, offset + w + F_start, pixelsPerSample));
+            row[w] = .5 * (1.0 + correlate(offset, offset + w + F_start, pixelsPerSample));
         }
     }
     upToDate = true;
 }
 
-double RepeatMap::correlate(vector<color>& img, int beginA, int beginB, int pixelsPerSample)//calculations for a single pixel
+/** Splits the color averaged pixels into one float array per channel (SoA) and builds
+  running sums of each channel and its square.  After this, the sums a correlation needs
+  for any stretch of pixels are two lookups, and only the cross terms A*B are left
+  to compute per (row, offset) pair.  Channels are scaled to 0-1, which doesn't change
+  a correlation but keeps float products small. */
+void RepeatMap::loadPlanarColors(vector<color>& img)
+{
+    int n = img.size();
+    for(int c = 0; c < 3; ++c)
+    {
+        planar[c].resize(n + 4);//padding for the last vector load
+        runningSum[c].resize(n + 1);
+        runningSquares[c].resize(n + 1);
+        runningSum[c][0] = 0.0;
+        runningSquares[c][0] = 0.0;
+    }
+    for(int i = 0; i < n; ++i)
+    {
+        float channel[3] = { img[i].r / 255.0f, img[i].g / 255.0f, img[i].b / 255.0f };
+        for(int c = 0; c < 3; ++c)
+        {
+            planar[c][i] = channel[c];
+            runningSum[c][i+1] = runningSum[c][i] + channel[c];
+            runningSquares[c][i+1] = runningSquares[c][i] + channel[c] * channel[c];
+        }
+    }
+}
+
+/** The three cross terms sum(A[k]*B[k]) of a correlation, four floats at a time when SSE is available. */
+static void crossTerms(const float* redA, const float* greenA, const float* blueA,
+                       const float* redB, const float* greenB, const float* blueB, int n, double* AB)
+{
+    int k = 0;
+    float red = 0, green = 0, blue = 0;
+#if defined(__SSE__)
+    __m128 vRed = _mm_setzero_ps();
+    __m128 vGreen = _mm_setzero_ps();
+    __m128 vBlue = _mm_setzero_ps();
+    for(; k + 4 <= n; k += 4)
+    {
+        vRed   = _mm_add_ps(vRed,   _mm_mul_ps(_mm_loadu_ps(redA + k),   _mm_loadu_ps(redB + k)));
+        vGreen = _mm_add_ps(vGreen, _mm_mul_ps(_mm_loadu_ps(greenA + k), _mm_loadu_ps(greenB + k)));
+        vBlue  = _mm_add_ps(vBlue,  _mm_mul_ps(_mm_loadu_ps(blueA + k),  _mm_loadu_ps(blueB + k)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, vRed);
+    red = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    _mm_storeu_ps(lanes, vGreen);
+    green = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    _mm_storeu_ps(lanes, vBlue);
+    blue = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+    for(; k < n; ++k)
+    {
+        red += redA[k] * redB[k];
+        green += greenA[k] * greenB[k];
+        blue += blueA[k] * blueB[k];
+    }
+    AB[0] = red;
+    AB[1] = green;
+    AB[2] = blue;
+}
+
+double RepeatMap::correlate(int beginA, int beginB, int pixelsPerSample)//calculations for a single pixel
 {//correlation will be a value between -1 and 1 representing how closley related 2 sequences are
-    //calculation variables!!!  should all be double to prevent overflow
     double N = pixelsPerSample;
-    int AVal;		int BVal;
-
-    double ARedsum = 0,	AGreensum = 0,		ABluesum = 0;   //our tuple of color sums
-    double BRedsum = 0,	BGreensum = 0,		BBluesum = 0;   //our tuple of color sums
-    double ASquaredRed = 0,	ASquaredGreen = 0,	ASquaredBlue = 0;  //this is Aij^2
-    double BSquaredRed = 0,	BSquaredGreen = 0,	BSquaredBlue = 0;  //this is Bij^2
-    double ABRed = 0, 	ABGreen =0,		ABBlue =0;	//this is A[]*B[]
-
-    for (int k = 0; k < pixelsPerSample; k++)
-    {//3 color shades RGB,  2 samples A and B
-        //reds
-        color A = img[beginA + k];
-        color B = img[beginB + k];
-        AVal = A.r;							BVal = B.r;
-        ARedsum += AVal;					BRedsum += BVal;
-        ASquaredRed += (AVal*AVal);			BSquaredRed += (BVal*BVal);
-        ABRed += (AVal * BVal);
-        //Greens
-        AVal = A.g;							BVal = B.g;
-        AGreensum += AVal;					BGreensum += BVal;
-        ASquaredGreen += (AVal*AVal);		BSquaredGreen += (BVal*BVal);
-        ABGreen += (AVal * BVal);
-        //Blues
-        AVal = A.b;							BVal = B.b;
-        ABluesum += AVal;					BBluesum += BVal;
-        ASquaredBlue += (AVal*AVal);		BSquaredBlue += (BVal*BVal);
-        ABBlue += (AVal * BVal);
+    if(pixelsPerSample < 1 || beginB + pixelsPerSample >= (int)runningSum[0].size())
+        return 0.0;
+
+    double AB[3];
+    crossTerms(&planar[0][beginA], &planar[1][beginA], &planar[2][beginA],
+               &planar[0][beginB], &planar[1][beginB], &planar[2][beginB], pixelsPerSample, AB);
 
+    double answer = 0.0;
+    for(int c = 0; c < 3; ++c)
+    {
+        double Asum = runningSum[c][beginA + pixelsPerSample] - runningSum[c][beginA];
+        double Bsum = runningSum[c][beginB + pixelsPerSample] - runningSum[c][beginB];
+        double ASquared = runningSquares[c][beginA + pixelsPerSample] - runningSquares[c][beginA];
+        double BSquared = runningSquares[c][beginB + pixelsPerSample] - runningSquares[c][beginB];
+
+        double numerator = AB[c] - Asum * Bsum / N;
+        double varianceA = ASquared - Asum * Asum / N;
+        double varianceB = BSquared - Bsum * Bsum / N;
+        //a channel with no variation (e.g. 0 instances of a color) has no correlation,
+        //the epsilon absorbs the rounding left over from subtracting running sums
+        if(varianceA > 1e-6 && varianceB > 1e-6)
+            answer += max(-1.0, min(1.0, numerator / sqrt(varianceA * varianceB)));
     }
 
-    //calculation time
-    double AbarRed = 0,	AbarGreen = 0,			AbarBlue = 0;  //A-tuple for color means
-    double BbarRed = 0,	BbarGreen = 0,			BbarBlue = 0;  //B-tuple for color means
-    AbarRed = ARedsum / N;	AbarGreen = AGreensum / N;	AbarBlue = ABluesum / N;
-    BbarRed = BRedsum / N;	BbarGreen = BGreensum / N;	BbarBlue = BBluesum / N;
+    return answer / 3;//return the average of RGB correlation
+}
 
-    double numerator_R = ABRed   - BbarRed   * ARedsum   - AbarRed * BRedsum     + AbarRed   * BbarRed   * N;
-    double numerator_G = ABGreen - BbarGreen * AGreensum - AbarGreen * BGreensum + AbarGreen * BbarGreen * N;
-    double numerator_B = ABBlue  - BbarBlue  * ABluesum  - AbarBlue * BBluesum   + AbarBlue  * BbarBlue  * N;
+/** freq is one contiguous row major block of freqRows x freqStride floats.  The stride
+  holds offsets 0 to F_width (offset 0 is unused) rounded up to a multiple of 8 so that
+  every row starts on a 32 byte boundary for vector loads.  The block only grows, so it is
+  reused from frame to frame and follows the display height instead of a fixed 400 lines. */
+void RepeatMap::resizeFreq(int rows)
+{
+    rows = max(1, rows);
+    int stride = ((F_width + 1) + 7) / 8 * 8;
+    if(rows != freqRows || stride != freqStride)
+    {
+        ringHead = 0;
+        hasComputedRows = false;
+    }
+    freqStride = stride;
+    int needed = rows * freqStride;
+    if(needed > freqCapacity)
+    {
+        delete [] freqBuffer;
+        freqCapacity = needed;
+        freqBuffer = new float[freqCapacity + 8];
+        freq = (float*)(((quintptr)freqBuffer + 31) & ~(quintptr)31);
+        for(int i = 0; i < freqCapacity; ++i)
+            freq[i] = 0.0;
+    }
+    freqRows = rows;
+}
 
-    double denom_R1 = (sqrt(ASquaredRed   - ((ARedsum   * ARedsum)  /N)));
-    double denom_R2 = (sqrt(BSquaredRed   - ((BRedsum   * BRedsum)  /N)));
-    double denom_G1 = (sqrt(ASquaredGreen - ((AGreensum * AGreensum)/N)));
-    double denom_G2 = (sqrt(BSquaredGreen - ((BGreensum * BGreensum)/N)));
-    double denom_B1 = (sqrt(ASquaredBlue  - ((ABluesum  * ABluesum) /N)));
-    double denom_B2 = (sqrt(BSquaredBlue  - ((BBluesum  * BBluesum) /N)));
+/** Everything that goes into a RepeatMap score block.  Color setting only matters above
+  scale 1 and the FFT mode only at scale 1, but it's simpler to always include them. */
+RepeatMapKey RepeatMap::currentKey()
+{
+    RepeatMapKey key;
+    key.sequence = sequence;
+    key.sequenceSize = sequence->size();
+    key.start = ui->getStart(glWidget);
+    key.width = ui->getWidth();
+    key.scale = ui->getScale();
+    key.rows = height();
+    key.fStart = F_start;
+    key.fWidth = F_width;
+    key.mode = (usingFftCorrelation ? 1 : 0) | (usingReverseComplement ? 2 : 0) | (ui->getColorSetting() << 8);
+    return key;
+}
 
-    double backup = sqrt(1 - (1/N));//if we have 0 instances of a color it will be / 0  div0
-    if(denom_R1 == 0) denom_R1 = backup;
-    if(denom_R2 == 0) denom_R2 = backup;
-    if(denom_G1 == 0) denom_G1 = backup;
-    if(denom_G2 == 0) denom_G2 = backup;
-    if(denom_B1 == 0) denom_B1 = backup;
-    if(denom_B2 == 0) denom_B2 = backup;
+/** Toggling back and forth between two widths or two loci should not recompute the
+  whole RepeatMap.  Score blocks are stored in an LRU QCache limited by memory (KB). On
+  a hit the scores are copied straight into freq and the texture is rebuilt from them. */
+bool RepeatMap::loadCachedScores(const RepeatMapKey& key)
+{
+    RepeatMapTile* tile = scoreCache.object(key);
+    if(tile == NULL)
+        return false;
 
-    double answer_R = numerator_R / (denom_R1 * denom_R2);
-    double answer_G = numerator_G / (denom_G1 * denom_G2);
-    double answer_B = numerator_B / (denom_B1 * denom_B2);
+    resizeFreq(tile->rows);
+    ringHead = 0;
+    for(int h = 0; h < tile->rows; ++h)
+    {
+        const float* cached = &tile->scores[h * F_width];
+        float* row = freqRow(h);
+        for(int w = 1; w <= F_width; w++)
+            row[w] = cached[w-1];
+    }
+    upToDate = true;
+    return true;
+}
+
+void RepeatMap::storeCachedScores(const RepeatMapKey& key)
+{
+    int rows = min(height(), freqRows);
+    RepeatMapTile* tile = new RepeatMapTile();
+    tile->rows = rows;
+    tile->scores.resize(rows * F_width);
+    for(int h = 0; h < rows; ++h)
+    {
+        const float* row = freqRow(h);
+        for(int w = 1; w <= F_width; w++)
+            tile->scores[h * F_width + w-1] = row[w];
+    }
+    int cost = max(1, (int)(tile->scores.size() * sizeof(float) / 1024));
+    scoreCache.insert(key, tile, cost);//QCache deletes the tile if it's too big to keep
+}
 
-    return (answer_R + answer_G + answer_B)/3;//return the average of RGB correlation
+/** If key is the last computed view moved by a whole number of lines, the lines still on
+  screen are kept in the ring.  The top of the ring moves and [firstRow, lastRow) is
+  narrowed to the lines that scrolled into view, and lines is how far it moved.  Returns
+  false if everything has to be computed again. */
+bool RepeatMap::scrollComputedRows(const RepeatMapKey& key, int& firstRow, int& lastRow, int& lines)
+{
+    int rows = lastRow - firstRow;
+    if(!hasComputedRows || rows != freqRows)
+        return false;
+    RepeatMapKey moved = computedKey;
+    moved.start = key.start;
+    if(!(moved == key))
+        return false;
+
+    int lineLength = key.width;//nucleotides per line of freq
+    if(key.scale > 1 && nuc != NULL && !usingReverseComplement)
+        lineLength = (key.width / key.scale) * key.scale;
+    int distance = key.start - computedKey.start;
+    if(lineLength < 1 || distance % lineLength != 0)
+        return false;
+    if(distance / lineLength == 0 || abs(distance / lineLength) >= rows)
+        return false;
+    lines = distance / lineLength;
+
+    ringHead = ((ringHead + lines) % rows + rows) % rows;
+    if(lines > 0)
+        firstRow = rows - lines;
+    else
+        lastRow = -lines;
+    return true;
+}
+
+void RepeatMap::setSequence(const string* seq)
+{
+    hasComputedRows = false;
+    scoreCache.clear();//the reader reuses the same string for a new file
+    periodicity.cancel();
+    AbstractGraph::setSequence(seq);
+}
+
+void RepeatMap::stopBackgroundWork()
+{
+    periodicity.cancel();
 }
 
 int RepeatMap::width()
 {
     int w = F_width;
-    if(using3merGraph && ui->getScale() == 1)
+    if(showing3merGraph())
         w += barWidth + spacerWidth;
     return w;
 }
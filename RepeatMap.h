@@ -13,9 +13,53 @@
 #include "AbstractGraph.h"
 #include "NucleotideDisplay.h"
 #include "UiVariables.h"
+#include "FftCorrelator.h"
+#include "PeriodicityTrack.h"
+#include "PackedSequence.h"
+#include <QCache>
 
 using namespace std;
 
+/** View parameters that identify one block of RepeatMap scores in the cache */
+struct RepeatMapKey
+{
+    const string* sequence;
+    int sequenceSize;
+    int start;
+    int width;
+    int scale;
+    int rows;//height(), which follows the display size
+    int fStart;
+    int fWidth;
+    int mode;
+
+    bool operator == (const RepeatMapKey& other) const
+    {
+        return sequence == other.sequence && sequenceSize == other.sequenceSize
+                && start == other.start && width == other.width && scale == other.scale
+                && rows == other.rows && fStart == other.fStart && fWidth == other.fWidth && mode == other.mode;
+    }
+};
+
+inline uint qHash(const RepeatMapKey& key)
+{
+    uint h = qHash((quintptr)key.sequence) ^ (uint)key.sequenceSize;
+    h = h * 31 + (uint)key.start;
+    h = h * 31 + (uint)key.width;
+    h = h * 31 + (uint)key.scale;
+    h = h * 31 + (uint)key.rows;
+    h = h * 31 + (uint)key.fStart;
+    h = h * 31 + (uint)key.fWidth;
+    return h * 31 + (uint)key.mode;
+}
+
+/** Cached scores: rows x F_width, without freq's padding */
+struct RepeatMapTile
+{
+    int rows;
+    vector<float> scores;
+};
+
 class RepeatMap : public AbstractGraph 
 {
     Q_OBJECT
@@ -28,24 +72,43 @@ public:
     void load_3mer_canvas(vector<float> scores);
     void link(NucleotideDisplay* nuc_display);
     void load_canvas();
+    bool scroll_canvas(int lines, int firstRow, int lastRow);
     void calculateOutputPixels();
     GLuint render();
     void freq_map();
+    void freq_map(int firstRow, int lastRow);
+    void fft_freq_map(const char* genome, int firstRow, int lastRow);
+    void reverse_freq_map(int firstRow, int lastRow);
     vector<float> convolution_3mer();
+    vector<float> lookup_3mer();
+    bool showing3merGraph();
+    bool convolving3mer();
     int height();
     string SELECT_MouseClick(point2D pt);
     int getRelativeIndexFromMouseClick(point2D pt);
 
     vector<point> bestMatches();
     void display_freq();
-    void calculate(vector<color>& img, int vote_size);
-    double correlate(vector<color>& img, int beginA, int beginB, int pixelsPerSample);
+    void calculate(vector<color>& img, int vote_size, int firstRow, int lastRow);
+    void loadPlanarColors(vector<color>& img);
+    void resizeFreq(int rows);
+    float* freqRow(int h);
+    double correlate(int beginA, int beginB, int pixelsPerSample);
     int width();
+    void setSequence(const string* seq);
+    void stopBackgroundWork();
+    RepeatMapKey currentKey();
+    bool loadCachedScores(const RepeatMapKey& key);
+    void storeCachedScores(const RepeatMapKey& key);
+    bool scrollComputedRows(const RepeatMapKey& key, int& firstRow, int& lastRow, int& lines);
 
 public slots:
     void changeFStart(int val);
     void changeGraphWidth(int val);
     void toggle3merGraph(bool m);
+    void toggleFftCorrelation(bool f);
+    void toggleReverseComplement(bool r);
+    void changeCacheSize(int megabytes);
 
 signals:
     void fStartChanged(int);
@@ -55,7 +118,14 @@ protected:
     TextureCanvas* canvas_3mer;
     NucleotideDisplay* nuc;
     GLuint display_object;
-    vector< vector<float> > freq;
+    float* freqBuffer;
+    float* freq;//32 byte aligned start of freqBuffer
+    int freqStride;
+    int freqRows;
+    int freqCapacity;
+    int ringHead;//freq is a ring of lines, this is the slot of the top line
+    bool hasComputedRows;
+    RepeatMapKey computedKey;//view the rows in freq were computed for
     int barWidth;
     int spacerWidth;
     int F_width;
@@ -65,6 +135,24 @@ protected:
     int freq_map_count;
     int calculate_count;
     bool using3merGraph;
+    bool usingFftCorrelation;
+    FftCorrelator fftCorrelator;
+    bool usingReverseComplement;
+    PackedSequence packedView;//visible sequence and its reverse complement
+    vector<float> planar[3];//RGB channels of nuc->outputPixels, one array per channel
+    vector<double> runningSum[3];
+    vector<double> runningSquares[3];
+    QCache<RepeatMapKey, RepeatMapTile> scoreCache;
+    PeriodicityTrack periodicity;
 };
 
+inline
+float* RepeatMap::freqRow(int h)
+{
+    int slot = ringHead + h;
+    if(slot >= freqRows)
+        slot -= freqRows;
+    return freq + slot * freqStride;
+}
+
 #endif
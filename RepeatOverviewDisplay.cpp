@@ -1,7 +1,11 @@
 //RepeatOverviewDisplay.cpp
+#include <algorithm>
 #include <sstream>
 #include "RepeatOverviewDisplay.h"
 #include "glwidget.h"
+#include <QFormLayout>
+#include <QSpinBox>
+#include <QPainter>
 
 /** ******************************  Graph Class
 Repeat Overview is the next step beyond RepeatMap.  As RepeatMap is a summary
@@ -21,11 +25,10 @@ work best at large scales, whereas all other Graphs start at scale 1 and work
 up.  RepeatOverview at scale 1 is not terribly meaningful.  ((I suppose each pixel
 would represent the number of nucleotides until that nucleotide was repeated.
 So given the sequence ACCAGG... the answer would be 31--1-...))  RepeatOverview
-is also very CPU intensive.  The current optimization packs 4 letters into one byte
-then does comparisons in groups of four.  This requires a lot of bit level logic
-and forces the scale to be a multiple of four.  This means that RepeatOverview
-is the only Graph mode that must push values back to the global ui, causing update
-challenges.  Example: RepeatOverviewDisplay::toggleVisibility()
+is also very CPU intensive.  It used to keep the scale to a multiple of four, from
+when 4 letters were packed into one byte, and push that back to the global ui.  Now
+any scale works: the packed sequence can be read starting at any nucleotide and the
+last word of each sample is masked, so RepeatOverview lines up with the other Graphs.
 
 It is important to realize that RepeatOverview is the most difficult because it is
 the most ambitious, not because it is badly written.  The computational complexity
@@ -41,64 +44,280 @@ So for Human Chromosome 1 which is 246 million letters, Skittle performs
 of the RepeatOver, updated in real-time.  THAT is why it's laggy.
 
 Performance Optimizations: Since there are only 4 possible nucleotides, RepeatOverview
-packs 4bp into the 8 bits of a byte.  This is stored in unsigned char* packSeq.  This
-garners a 4x speed increase.  Furthermore, the comparisons are done using operations
-over the size of one long int, which is at least 64 bits.  This is at least another
-16x increase in performance, however it incurs overhead.  In order to work with these
-packed data types the header file contains a set of methods labeled "Optimized Long Int Accessors"
-and "Optimized Packed Sequence Methods".
-
-The bit logic in methods like countMatchesShort() bears explaining.  With four possibilities,
-a nucleotide take up two bits.  With one bit words, the number of 1's in an XOR will tell you
-the number of differences between two strings.  However, with nucleotides an XOR result of
-11, 10, and 01 all count as 1 difference.  This means that you have to look at 2 bits at a time
-instead of simply counting.  So 1101 is 2 differences, 0110 is 2 differences and 0011 is one
-difference.
+packs 32bp into each 64 bit word of a PackedSequence.  The reference for a pixel is read
+into words once, then each offset is one XOR per 32bp against the sequence read at that
+offset.  Words are fixed at 64 bits, so nothing depends on the size of long int.
+
+The bit logic bears explaining.  With four possibilities, a nucleotide take up two bits.
+With one bit words, the number of 1's in an XOR will tell you the number of differences
+between two strings.  However, with nucleotides an XOR result of 11, 10, and 01 all count
+as 1 difference.  (x | x >> 1) & 0x5555... folds each pair of bits into its low bit, so
+a hardware popcount gives the number of differences.  So 1101 is 2 differences, 0110 is
+2 differences and 0011 is one difference.
+
+The pixels are independent of each other, so calculateOutputPixels() hands them to a
+thread per core in small blocks and returns without waiting.  Before the threads start,
+each pixel gets a rough color from only 32bp in the middle of its window, so something
+useful is on screen right away.  Finished blocks are copied over the estimate and the
+texture is refreshed as they come in.  Moving the view cancels the job in progress.
+
+The scan range is a setting, up to 10,000 offsets, so satellite repeats of a few kb
+show up too.  Every extra offset costs one more XOR per 32bp.  Past 500 offsets the
+hues are spread on a log scale, otherwise the short periods would all look blue.
+
+Zoomed out past 64bp per pixel on a large sequence, the pixels come from an
+OverviewPyramid instead.  It scans the whole sequence once in the background at 16bp
+per cell and keeps coarser levels, so a whole chromosome is drawn by lookups.  It is
+saved next to the sequence file and read back the next time that file is opened.
 
 Development:
 *Add text to the spectrum legend.  Issue #11
 *Make it useful at scale = 1.  Issue #33
 *************************************/
 
+static const int defaultScanRange = 248;//62 * 4, from the byte packed version
+static const int maxScanRange = 10000;
+static const int logLegendRange = 500;
+static const int estimateSampleLength = 32;
+static const double estimateBudget = 4000000;//offset comparisons, ~10ms on one core
+
 RepeatOverviewDisplay::RepeatOverviewDisplay(UiVariables* gui, GLWidget* gl)
     :NucleotideDisplay(gui, gl)
 {
     hidden = true;
-    charPerIndex = 4;
-    internalScale = charPerIndex;
+    internalScale = 1;
     sequence = NULL;
-    packSeq = NULL;
-    countTableShort = NULL;
-    countTableChar = NULL;
-    pSeqSize = 0;
+    packedIsCurrent = false;
     legendWidth = 10;
+    scanRange = defaultScanRange;
 
-    calcMatchTable();
-    //packSequence is called by setSequence()
+    jobStart = jobEnd = jobScale = 0;
+    jobKernel = &RepeatOverviewDisplay::genericAlignment;
+    jobBlockSize = jobBlockCount = jobPixelCount = 0;
+    jobGeneration = 0;
+    jobRunning = false;
+    jobCancelled = false;
+    connect(&pyramid, SIGNAL(pyramidReady()), this, SLOT(invalidate()));
 
     actionLabel = string("Repeat Overview");
     actionTooltip = string("Color by the best alignment offset");
     actionData = actionLabel;
 }
+
+RepeatOverviewDisplay::~RepeatOverviewDisplay()
+{
+    cancelAlignmentJob();
+    pyramid.cancel();
+}
 void RepeatOverviewDisplay::checkVariables()
 {
-    internalScale = max(charPerIndex, (int)(ui->getScale() / charPerIndex) * charPerIndex);
+    internalScale = max(1, ui->getScale());
 }
 
+/** Starts the threads for the current view and returns right away.  The texture is
+  replaced by finishAlignmentJob() once every pixel is done. */
 void RepeatOverviewDisplay::calculateOutputPixels()
 {
-    /**/
     qDebug() << "RepeatOverviewDisplay::load: " << ++frameCount;
+    qDebug() << "Width: " << ui->getWidth() << "\nScale: " << ui->getScale() << "\nStart: " << ui->getStart(glWidget);
+
+    int start, end;
+    alignmentRange(start, end);
+    startPyramid();
+    if(usingPyramid())
+    {
+        pyramidPixels(start, end);
+        return;
+    }
+    if(jobRunning && start == jobStart && end == jobEnd && internalScale == jobScale)
+        return;//already working on this view
+    startAlignmentJob(start, end, internalScale);
+}
 
+/** Pixel i covers [start + i*scale, start + (i+1)*scale) for every start < end. */
+void RepeatOverviewDisplay::alignmentRange(int& start, int& end)
+{
+    start = ui->getStart(glWidget);
+    end = max(1, (start + current_display_size()) - (scanRange + 3));
+}
 
-    qDebug() << "Width: " << ui->getWidth() << "\nScale: " << ui->getScale() << "\nStart: " << ui->getStart(glWidget);
-    vector<color> alignment_colors;
-    int end = max(1, (ui->getStart(glWidget) + current_display_size()) - 251);
-    for(int i = ui->getStart(glWidget); i < end; i += internalScale)
-        alignment_colors.push_back( simpleAlignment(i) );
+/** Runs one alignmentWorker() on alignmentPool.  Qt 4's QtConcurrent::run() can only
+  use the global pool. */
+class AlignmentWorker : public QRunnable
+{
+public:
+    AlignmentWorker(RepeatOverviewDisplay* display, int generation)
+        :display(display), generation(generation)
+    {
+    }
+
+    void run()
+    {
+        display->alignmentWorker(generation);
+    }
+
+private:
+    RepeatOverviewDisplay* display;
+    int generation;
+};
+
+/** Pixels are split into blocks of roughly equal work.  Every thread takes the next
+  unclaimed block off a shared counter until none are left, so a thread that gets
+  cheap (unsequenced) blocks just takes more of them. */
+void RepeatOverviewDisplay::startAlignmentJob(int start, int end, int scale)
+{
+    cancelAlignmentJob();
+    packSequence();
+
+    jobStart = start;
+    jobEnd = end;
+    jobScale = scale;
+    jobKernel = alignmentKernel(scale);
+    int pixels = max(0, (end - start + scale - 1) / scale);
+    jobPixels.assign(pixels, color(0,0,0));
+    jobPixelCount = pixels;
+    if(pixels == 0)
+    {
+        vector<color> frame;
+        storeDisplay(frame, width()-legendWidth);
+        upToDate = true;
+        return;
+    }
+    if(scale > estimateSampleLength)
+    {
+        estimatePixels(start, scale, jobPixels);
+        vector<color> frame(jobPixels);
+        storeDisplay(frame, width()-legendWidth);
+    }
+    jobBlockSize = max(16, 32768 / scale);
+    jobBlockCount = (pixels + jobBlockSize - 1) / jobBlockSize;
+    nextBlock = 0;
+    refreshPending = 0;
+
+    int threads = max(1, min(jobBlockCount, alignmentPool.maxThreadCount()));
+    activeWorkers = threads;
+    jobCancelled = false;
+    jobRunning = true;
+    ++jobGeneration;
+    for(int i = 0; i < threads; ++i)
+        alignmentPool.start(new AlignmentWorker(this, jobGeneration));
+}
+
+/** Blocks until the threads notice.  They check between blocks, which are small. */
+void RepeatOverviewDisplay::cancelAlignmentJob()
+{
+    jobCancelled = true;
+    alignmentPool.waitForDone();
+    jobRunning = false;
+}
+
+void RepeatOverviewDisplay::alignmentWorker(int generation)
+{
+    while(!jobCancelled)
+    {
+        int block = nextBlock.fetchAndAddOrdered(1);
+        if(block >= jobBlockCount)
+            break;
+        int first = block * jobBlockSize;
+        int last = min(jobPixelCount, first + jobBlockSize);
+        vector<color> blockPixels;
+        for(int i = first; i < last && !jobCancelled; ++i)
+        {
+            pair<int,int> answer = (this->*jobKernel)(jobStart + i * jobScale, jobScale);
+            blockPixels.push_back(alignment_color(answer.first, answer.second, jobScale));
+        }
+        if(jobCancelled)
+            break;
+        jobPixelsLock.lock();
+        copy(blockPixels.begin(), blockPixels.end(), jobPixels.begin() + first);
+        jobPixelsLock.unlock();
+        if(refreshPending.testAndSetOrdered(0, 1))//one refresh in the queue is enough
+            QMetaObject::invokeMethod(this, "refreshAlignmentJob", Qt::QueuedConnection, Q_ARG(int, generation));
+    }
+    if(!activeWorkers.deref())//last one out
+        QMetaObject::invokeMethod(this, "finishAlignmentJob", Qt::QueuedConnection, Q_ARG(int, generation));
+}
+
+/** A quick first frame: each pixel is scored from one word in the middle of its window.
+  If that is still too much work for the budget, only every stride-th pixel is scored and
+  its color is copied to the pixels after it. */
+void RepeatOverviewDisplay::estimatePixels(int start, int scale, vector<color>& pixels)
+{
+    int sampleLength = min(scale, estimateSampleLength);
+    int stride = max(1, (int)ceil(double(pixels.size()) * scanRange / estimateBudget));
+    for(int i = 0; i < (int)pixels.size(); i += stride)
+    {
+        int index = start + i * scale + (scale - sampleLength) / 2;
+        pair<int,int> answer = getBestAlignment(index, sampleLength);
+        color c = alignment_color(answer.first, answer.second, sampleLength);
+        for(int k = i; k < min((int)pixels.size(), i + stride); ++k)
+            pixels[k] = c;
+    }
+}
+
+/** Shows the blocks finished so far on top of the estimate. */
+void RepeatOverviewDisplay::refreshAlignmentJob(int generation)
+{
+    refreshPending = 0;
+    if(!jobRunning || generation != jobGeneration)
+        return;
+    jobPixelsLock.lock();
+    vector<color> frame(jobPixels);
+    jobPixelsLock.unlock();
+    storeDisplay(frame, width()-legendWidth);
+    emit displayChanged();
+}
+
+void RepeatOverviewDisplay::finishAlignmentJob(int generation)
+{
+    if(!jobRunning || generation != jobGeneration)
+        return;//cancelled, or a newer job has started
+    alignmentPool.waitForDone();
+    jobRunning = false;
+
+    int start, end;
+    alignmentRange(start, end);
+    vector<color> frame(jobPixels);
+    storeDisplay(frame, width()-legendWidth);
+    if(start == jobStart && end == jobEnd && internalScale == jobScale)
+        upToDate = true;//otherwise the next display() starts the current view
+    emit displayChanged();
+}
 
-    storeDisplay( alignment_colors, width()-legendWidth);
+/** Large sequences only: below a few Mbp the threads keep up with scrolling anyway. */
+void RepeatOverviewDisplay::startPyramid()
+{
+    if(sequence == NULL || sequence->size() < 4000000 || pyramid.isReady() || pyramid.isBuilding())
+        return;
+    cancelAlignmentJob();//the pyramid reads packed too
+    packSequence();
+    QString cacheFile;
+    if(!glWidget->sequenceFile.empty())
+        cacheFile = QString(glWidget->sequenceFile.c_str()) + "-skittle_overview";
+    pyramid.build(this, sequence, cacheFile, scanRange);
+}
+
+/** Each pixel needs to cover a few base cells or the merged scores are too coarse. */
+bool RepeatOverviewDisplay::usingPyramid()
+{
+    return pyramid.isReady() && internalScale >= 4 * OverviewPyramid::baseScale;
+}
 
+void RepeatOverviewDisplay::pyramidPixels(int start, int end)
+{
+    cancelAlignmentJob();
+    int scale = internalScale;
+    vector<color> pixels;
+    for(int i = start; i < end; i += scale)
+    {
+        float score = 0;
+        int period = 0;
+        if(pyramid.lookup(i, scale, score, period))
+            pixels.push_back(alignment_color((int)(score * scale + .5), period, scale));
+        else
+            pixels.push_back(color(0,0,0));
+    }
+    storeDisplay(pixels, width()-legendWidth);
     upToDate = true;
 }
 
@@ -116,7 +335,7 @@ void RepeatOverviewDisplay::display()
 
 int RepeatOverviewDisplay::width()
 {
-    return legendWidth + max(1, (int)((float)ui->getWidth() / (float)internalScale + 0.5));
+    return legendWidth + max(1, ui->getWidth() / internalScale);
 }
 
 void RepeatOverviewDisplay::displayLegend(float canvasWidth, float canvasHeight)
@@ -128,7 +347,7 @@ void RepeatOverviewDisplay::displayLegend(float canvasWidth, float canvasHeight)
         vector<color> paintIt;
         for(float i = 0; i < canvasHeight; i++)
         {
-            paintIt.push_back(alignment_color(internalScale, (i/canvasHeight)*250));//spectrum(i/255.0);
+            paintIt.push_back(glWidget->spectrum(i/canvasHeight));
         }
         TextureCanvas paint = TextureCanvas( paintIt, 1);
         glPushMatrix();
@@ -136,9 +355,21 @@ void RepeatOverviewDisplay::displayLegend(float canvasWidth, float canvasHeight)
             paint.display();
         glPopMatrix();
 
-        paint_image(point(legendWidth/2,canvasHeight/250+2,.1), string(":/ro-label-1.png"));
-        paint_image(point(legendWidth/2,canvasHeight/2,.1), string(":/ro-label-125.png"));
-        paint_image(point(legendWidth/2,canvasHeight-2,.1), string(":/ro-label-250.png"));
+        if(scanRange == defaultScanRange)
+        {
+            paint_image(point(legendWidth/2,canvasHeight/250+2,.1), string(":/ro-label-1.png"));
+            paint_image(point(legendWidth/2,canvasHeight/2,.1), string(":/ro-label-125.png"));
+            paint_image(point(legendWidth/2,canvasHeight-2,.1), string(":/ro-label-250.png"));
+        }
+        else
+        {
+            vector<int> values = legendValues();
+            for(int i = 0; i < (int)values.size(); ++i)
+            {
+                float y = min(canvasHeight - 2, max(canvasHeight/250 + 2, (float)(canvasHeight * offsetHue(values[i]))));
+                paint_image(point(legendWidth/2,y,.1), legendLabel(values[i]));
+            }
+        }
 
 
 
@@ -173,13 +404,69 @@ void RepeatOverviewDisplay::displayLegend(float canvasWidth, float canvasHeight)
 
 color RepeatOverviewDisplay::alignment_color(int score, int frequency)
 {
-    color c = glWidget->spectrum((double)(frequency) / 250.0);//
+    return alignment_color(score, frequency, internalScale);
+}
+
+/** Threads pass the scale of their job, since internalScale can change under them. */
+color RepeatOverviewDisplay::alignment_color(int score, int frequency, int sampleLength)
+{
+    color c = glWidget->spectrum(offsetHue(frequency));
     color black = color(0,0,0);
-    c = interpolate(black, c, score / float(internalScale));
+    c = interpolate(black, c, score / float(sampleLength));
 
     return c;
 }
 
+/** 0 to 1 along the spectrum.  Linear up to logLegendRange, which keeps the old 1-250
+  colors for the default range.  Logarithmic beyond that. */
+double RepeatOverviewDisplay::offsetHue(double frequency)
+{
+    if(scanRange <= logLegendRange)
+        return frequency / max(250, scanRange);
+    return log(max(1.0, frequency)) / log((double)scanRange);
+}
+
+/** Offsets to label on the legend: both ends and the middle, or the powers of ten. */
+vector<int> RepeatOverviewDisplay::legendValues()
+{
+    vector<int> values;
+    if(scanRange <= logLegendRange)
+    {
+        int top = max(250, scanRange);
+        values.push_back(1);
+        values.push_back(top / 2);
+        values.push_back(top);
+        return values;
+    }
+    int power = 1;
+    for(; power < scanRange; power *= 10)
+        values.push_back(power);
+    if(scanRange >= 2 * values.back())
+        values.push_back(scanRange);
+    return values;
+}
+
+/** Drawn at three times the legend size, like the ro-label images. */
+QPixmap RepeatOverviewDisplay::legendLabel(int value)
+{
+    QString text = QString::number(value);
+    QFont font;
+    font.setPixelSize(12);
+    font.setBold(true);
+    int labelWidth = QFontMetrics(font).width(text) + 8;
+    QPixmap label(labelWidth, 16);
+    label.fill(Qt::transparent);
+    QPainter painter(&label);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setPen(QColor(150,150,150));
+    painter.setBrush(Qt::white);
+    painter.drawRoundedRect(QRectF(0.5, 0.5, labelWidth - 1, 15), 4, 4);
+    painter.setPen(QColor(60,60,60));
+    painter.setFont(font);
+    painter.drawText(label.rect(), Qt::AlignCenter, text);
+    return label;
+}
+
 color RepeatOverviewDisplay::interpolate(color p1, color p3, double progress)//progress goes from 0.0 p1  to 1.0 p2
 {
     double inverse = 1.0 - progress;
@@ -189,213 +476,239 @@ color RepeatOverviewDisplay::interpolate(color p1, color p3, double progress)//p
     return color(x2, y2, z2);
 }
 
-int RepeatOverviewDisplay::countMatchesShort(unsigned short int bits)
+/** Packing the whole sequence is deferred until RepeatOverview is shown, since it is
+  hidden by default. */
+void RepeatOverviewDisplay::packSequence()
 {
-    int c = 0;
-    for(int i = 0; i < (int)(sizeof(unsigned short int) * 4); ++i)
-    {
-        if( ((bits >> (i*2)) & 3) == 0)// 3 = 00011 look at last two bits
-            ++c;
-    }
-    return c;
+    if(packedIsCurrent || sequence == NULL)
+        return;
+    packed.pack(sequence->c_str(), sequence->size());
+    packedIsCurrent = true;
 }
 
-int RepeatOverviewDisplay::countMatchesChar(unsigned char bits)
+color RepeatOverviewDisplay::simpleAlignment(int index)
 {
-    int c = 0;
-    for(int i = 0; i < 4; ++i)
-    {
-        if( ((bits >> (i*2)) & 3) == 0)// 3 = 00000011 look at last two bits
-            ++c;
-    }
-    return c;
+    pair<int,int> answer = getBestAlignment(index);
+
+    return alignment_color(answer.first , answer.second);
 }
 
-void RepeatOverviewDisplay::calcMatchTable()
+/** Offsets are visited in the same order as the old byte packed version (every 4th
+  offset, then the next read frame) so that the tie breaking, and the colors, stay the
+  same.  A shorter offset wins if it scores within 10% of the best so far.  Each
+  offset costs one XOR and popcount per 32bp of sample, whatever the scan range. */
+pair<int,int> RepeatOverviewDisplay::getBestAlignment(int index)
 {
-    countTableShort = new int[65536];
-    for(unsigned short int index = 0; true; ++index)
-    {
-        countTableShort[index] = countMatchesShort(index);
-        if(index == 65535)//last possible index: we can't check for this beforehand because of overflow
-            break;
-    }
-
-    countTableChar = new int[256];
-    for(unsigned short int index = 0; ; ++index)
-    {
-        countTableChar[index] = countMatchesChar(index);
-        if(index == 255)//last possible index: we can't check for this beforehand because of overflow
-            break;
-    }
+    packSequence();
+    return getBestAlignment(index, internalScale);
 }
 
-void RepeatOverviewDisplay::normalPack(const string* seq)
+/** Tracks the winner as offsets are offered in the frame-major order. */
+struct BestOffset
 {
-    if(packSeq)
-        delete [] packSeq;
-    packSeq = new unsigned char[seq->size() / charPerIndex] ;
-    pSeqSize = seq->size() / charPerIndex;
+    int max_score;
+    int qualifying;
+    int raised_bar;//ceil(max_score * 1.1)
+    int best_freq;
+
+    BestOffset(int scanRange)
+        :max_score(0), qualifying(0), raised_bar(0), best_freq(scanRange)//past every offset
+    {
+    }
 
-    for(unsigned int i = 0; i+charPerIndex < seq->size(); i+=charPerIndex)
+    inline void offer(int score, int current_offset)
     {
-        unsigned char num = 0;
-        for(unsigned int n = 0; n < charPerIndex; ++n)
+        if(score >= qualifying && (current_offset < best_freq || score >= raised_bar))
         {
-            // A 00 C = 01 G = 10 T = 11
-            num = num << 2;
-            if((*seq)[i + n] == 'C')
-                num += 1;
-            else if((*seq)[i + n] == 'G')
-                num += 2;
-            else if((*seq)[i + n] == 'T')
-                num += 3;
+            max_score = score;
+            qualifying = max(0, (int)(floor(score / 1.1)));
+            raised_bar = (int)(ceil(score * 1.1));
+            best_freq = current_offset;
         }
-        packSeq[i/charPerIndex] = num;
     }
-    //cout << "Finished packing bits" << endl;
-}
+};
 
-void RepeatOverviewDisplay::shiftMask(char* str, int size)
+/** Safe to call from the alignment threads: it only reads packed.  Any index and
+  sample_length work, since bases() reads from any nucleotide and only the last word
+  of the reference is masked. */
+pair<int,int> RepeatOverviewDisplay::getBestAlignment(int index, int sample_length)
 {
-    for(int i = size -1; i != -1; --i)
-    {
-        if(i != size-1)
-            str[i+1] |= str[i] << 6;//add the remainder to the following letter  11000000
-
-        if(i != 0 && str[i-1] << 6 == 0)
-            str[i] = ((unsigned char)str[i]) >> 2;//00111111 create a space in front
-        else
-            str[i] = str[i] >> 2;
-    }
-    if( str[0] == 0)
-        str[0] = 192;//the bit mask should start growing from 0
+    return (this->*alignmentKernel(sample_length))(index, sample_length);
 }
 
-void RepeatOverviewDisplay::shiftString(unsigned char* str, int size)
+/** The specialized kernels cover the scales people actually zoom to.  Everything else,
+  including every scale past two words, goes through genericAlignment().  Each has a
+  clone built for the popcnt instruction, used when the CPU has it. */
+RepeatOverviewDisplay::AlignmentKernel RepeatOverviewDisplay::alignmentKernel(int sample_length)
 {
-    str[size-1] = str[size-1] >> 2;
-    for(int i = size -2; i != -1; --i)
+#ifdef PACKED_POPCNT_KERNEL
+    if(PackedSequence::hardwarePopcount())
+    {
+        switch(sample_length)
+        {
+        case 4:  return &RepeatOverviewDisplay::fixedAlignmentPopcnt<4>;
+        case 8:  return &RepeatOverviewDisplay::fixedAlignmentPopcnt<8>;
+        case 16: return &RepeatOverviewDisplay::fixedAlignmentPopcnt<16>;
+        case 32: return &RepeatOverviewDisplay::fixedAlignmentPopcnt<32>;
+        case 64: return &RepeatOverviewDisplay::fixedAlignmentPopcnt<64>;
+        default: return &RepeatOverviewDisplay::genericAlignmentPopcnt;
+        }
+    }
+#endif
+    switch(sample_length)
     {
-        str[i+1] |= str[i] << 6;//add the remainder to the following letter  11000000
-        str[i] = str[i] >> 2;//00111111 create a space in front
+    case 4:  return &RepeatOverviewDisplay::fixedAlignment<4>;
+    case 8:  return &RepeatOverviewDisplay::fixedAlignment<8>;
+    case 16: return &RepeatOverviewDisplay::fixedAlignment<16>;
+    case 32: return &RepeatOverviewDisplay::fixedAlignment<32>;
+    case 64: return &RepeatOverviewDisplay::fixedAlignment<64>;
+    default: return &RepeatOverviewDisplay::genericAlignment;
     }
 }
 
-color RepeatOverviewDisplay::simpleAlignment(int index)
+/** Length is known at compile time, so the reference lives in registers, the mask is a
+  constant and the word loop unrolls away.  Same results as genericAlignment(). */
+template<int Length>
+KERNEL_INLINE
+pair<int,int> RepeatOverviewDisplay::fixedAlignment(int index, int)
 {
-    pair<int,int> answer = getBestAlignment(index);
+    if(index < 0 || index + Length + scanRange > packed.size())
+        return pair<int,int>(0,0);
+    if(packed.known(index) == 0)//unsequenced
+        return pair<int,int>(0,0);
 
-    return alignment_color(answer.first , answer.second);
+    const int words = (Length + 31) / 32;
+    const quint64 lastMask = (Length % 32 == 0) ? PackedSequence::lowBits
+            : PackedSequence::lowBits & ((Q_UINT64_C(1) << (2 * (Length % 32))) - 1);
+    quint64 reference[words];
+    for(int k = 0; k < words; ++k)
+        reference[k] = packed.bases(index + k * 32);
+
+    BestOffset best(scanRange);
+    for(int frame = 0; frame < 4; ++frame)
+    {
+        for(int current_offset = frame; current_offset < scanRange; current_offset += 4)
+        {
+            if(current_offset == 0)
+                continue;//self vs. self
+            int mismatches = 0;
+            for(int k = 0; k < words; ++k)
+            {
+                quint64 x = reference[k] ^ packed.bases(index + current_offset + k * 32);
+                mismatches += popcount64((x | (x >> 1)) & (k == words - 1 ? lastMask : PackedSequence::lowBits));
+            }
+            best.offer(Length - mismatches, current_offset);
+        }
+    }
+    return pair<int,int>(best.max_score, best.best_freq);
 }
 
-pair<int,int> RepeatOverviewDisplay::getBestAlignment(int index)
+KERNEL_INLINE
+pair<int,int> RepeatOverviewDisplay::genericAlignment(int index, int sample_length)
 {
-    if(packSeq[index/4] == 0)
+    if(index < 0 || index + sample_length + scanRange > packed.size())
+        return pair<int,int>(0,0);
+    if(packed.known(index) == 0)//unsequenced
         return pair<int,int>(0,0);
 
-    //scale % 4 == 0 always
-    int reference_size = internalScale / 4 + 2;//sequence bytes = scale / 4.  1 byte of padding for shifts. 1 byte for sub_index.
-    int bitmask_size = reference_size + sizeof(long int);
-    int pack_index = index / 4;
-    int sub_index = index % 4;
-    int max_score = 0;
-    int qualifying = 0;
-    int best_freq = 251;
-    unsigned char reference[reference_size];// = packSeq + index/4;
-    char bitmask[bitmask_size];
-    for(int i = 0; i < reference_size; ++i)
-        reference[i] = packSeq[i+pack_index];//copy values
-
-    int string_end = internalScale/4;
-    for(int i = 0; i < bitmask_size; ++i)
-    {
-        if( i < string_end)
-            bitmask[i] = 0;
-        else
-            bitmask[i] = 255;
-    }
-    if(sub_index)
+    int words = (sample_length + 31) / 32;
+    quint64 localWords[64];
+    vector<quint64> longWords;
+    quint64* reference = localWords;
+    if(words > 64)
     {
-        if(sub_index == 1)		bitmask[0] = 192;
-        else if(sub_index == 2)	bitmask[0] = 240;
-        else if(sub_index == 3)	bitmask[0] = 252;
-
-        if(sub_index == 1)		bitmask[string_end] = 63;
-        else if(sub_index == 2)	bitmask[string_end] = 15;
-        else if(sub_index == 3)	bitmask[string_end] = 3;
-
+        longWords.resize(words);
+        reference = &longWords[0];
     }
-    else{
-        --string_end;
-    }
-    for(int i = string_end + 1; i < bitmask_size; ++i)
-        bitmask[i] = 255;//fill the tail with 1's
+    for(int k = 0; k < words; ++k)
+        reference[k] = packed.bases(index + k * 32);
 
+    quint64 lastMask = PackedSequence::lowBits;
+    if(sample_length < 32)
+        lastMask &= (Q_UINT64_C(1) << (2 * sample_length)) - 1;
 
-    for(int frame = 0; frame < 4; ++frame) // 4 read frames.  Step Size = 2 bits
+    BestOffset best(scanRange);
+    for(int frame = 0; frame < 4; ++frame)
     {
-        unsigned char* target = packSeq + pack_index;//a pointer into sequence.  Long int read frame
-        for(int offset = 0; offset < 62; ++offset)// 62 * 4 = 248
+        for(int current_offset = frame; current_offset < scanRange; current_offset += 4)
         {
-            int score = 0;
-            for(int position = 0; position < reference_size; position+=sizeof(long int))
+            if(current_offset == 0)
+                continue;//self vs. self
+            int score;
+            if(words == 1)//skip the loop setup
             {
-                unsigned long int diff = (*((unsigned long int*)(reference + position))) ^ (*((unsigned long int*)(target + position)));
-                diff = diff | *((unsigned long int*)(bitmask + position));
-                score += countTableShort[ (unsigned short int)diff ];//NOTE: This inherently assumes long = short*2
-                score += countTableShort[ (unsigned short int)(diff >> 16) ];//and that sizeof(long int)*8 == 32
+                quint64 x = reference[0] ^ packed.bases(index + current_offset);
+                score = sample_length - popcount64((x | (x >> 1)) & lastMask);
             }
-            if(score >= qualifying)
-            {
-                if(offset || frame)//offset = 0 will always come through because of the loop
-                {//it's more important to ensure we don't incur a check on every offset
-                    int current_offset = offset * 4 + frame;
-                    if(current_offset < best_freq)
-                    {
-                        max_score = score;
-                        qualifying = max(0, (int)(floor(score / 1.1)));
-                        best_freq = current_offset;
-                    }
-                    else if(score >= (int)(ceil(max_score * 1.1)))
-                    {
-                        max_score = score;
-                        qualifying = max(0, (int)(floor(score / 1.1)));
-                        best_freq = current_offset;
-                    }
-
-                }
-            }
-
-            ++target;//increment the target to the next offset
+            else
+                score = sample_length - packed.mismatches(reference, sample_length, index + current_offset);
+            best.offer(score, current_offset);
         }
-        shiftString(reference, reference_size);//shift two bits to the left
-        shiftMask(bitmask, bitmask_size);
     }
-    if(best_freq == 0) best_freq = 1;
-    //max_score = scale;
-    return pair<int,int>(max_score, best_freq);
+    return pair<int,int>(best.max_score, best.best_freq);
+}
+
+#ifdef PACKED_POPCNT_KERNEL
+template<int Length>
+POPCNT_TARGET
+pair<int,int> RepeatOverviewDisplay::fixedAlignmentPopcnt(int index, int sample_length)
+{
+    return fixedAlignment<Length>(index, sample_length);
 }
 
+POPCNT_TARGET
+pair<int,int> RepeatOverviewDisplay::genericAlignmentPopcnt(int index, int sample_length)
+{
+    return genericAlignment(index, sample_length);
+}
+#endif
+
 void RepeatOverviewDisplay::setSequence(const string* seq)
 {
+    cancelAlignmentJob();
+    pyramid.cancel();
     sequence = seq;
-    normalPack(seq);
+    packedIsCurrent = false;
 }
 
-void RepeatOverviewDisplay::changeScale(int s)
+void RepeatOverviewDisplay::stopBackgroundWork()
 {
-    ui->print("RepeatOverviewDisplay::changeScale ", s);
-    ui->setScale(s);
+    cancelAlignmentJob();
+    pyramid.cancel();
 }
 
-void RepeatOverviewDisplay::toggleVisibility()
+QScrollArea* RepeatOverviewDisplay::settingsUi()
 {
-    if(hidden)
-    {
-        checkVariables();
-    }
-    AbstractGraph::toggleVisibility();
+    settingsTab = new QScrollArea();
+    settingsTab->setWindowTitle(QString("Repeat Overview Settings"));
+    QFormLayout* formLayout = new QFormLayout;
+    formLayout->setRowWrapPolicy(QFormLayout::WrapLongRows);
+    settingsTab->setLayout(formLayout);
+
+    QSpinBox* scanRangeDial = new QSpinBox(settingsTab);
+    scanRangeDial->setMinimum(8);
+    scanRangeDial->setMaximum(maxScanRange);
+    scanRangeDial->setSingleStep(50);
+    scanRangeDial->setSuffix(" bp");
+    scanRangeDial->setValue(scanRange);
+    scanRangeDial->setToolTip("Longest repeat period to look for.  Time grows with the range.");
+    formLayout->addRow("Scan Range:", scanRangeDial);
+    connect( scanRangeDial, SIGNAL(valueChanged(int)), this, SLOT(changeScanRange(int)));
+
+    return settingsTab;
+}
+
+/** The threads and the pyramid both read scanRange, so they are stopped first.  The
+  pyramid is rebuilt for the new range. */
+void RepeatOverviewDisplay::changeScanRange(int range)
+{
+    range = max(8, min(maxScanRange, range));
+    if(range == scanRange)
+        return;
+    cancelAlignmentJob();
+    pyramid.cancel();
+    scanRange = range;
+    invalidate();
 }
 
 string RepeatOverviewDisplay::SELECT_StringFromMouseClick(int index)
@@ -417,16 +730,15 @@ string RepeatOverviewDisplay::FIND_StringFromMouseClick(int index)
 }
 
 
-/** This method had to be reimplemented in RepeatOverview because the indices
-will be out of sync with the display unless it uses internalScale as opposed
-to ui->getScale().  */
+/** This method had to be reimplemented in RepeatOverview because the legend takes
+up the first legendWidth pixels of every row.  */
 int RepeatOverviewDisplay::getRelativeIndexFromMouseClick(point2D pt)
 {
     if( pt.x < width() && pt.x >= 0 && pt.y <= height() )//check if it is inside the box
     {
         pt.x -= legendWidth;
         if (pt.x < 0) return -1;
-        int index = pt.y * width()*internalScale //the bp per line is not quite ui->getWidth() because it needs to be a multiple of 4.
+        int index = pt.y * (width()-legendWidth) * internalScale //same rows as storeDisplay()
                 + pt.x * internalScale;
         index = max(0, index);
         return index;
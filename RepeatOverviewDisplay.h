@@ -7,6 +7,11 @@
 #include "BasicTypes.h"
 #include "UiVariables.h"
 #include "NucleotideDisplay.h"
+#include "PackedSequence.h"
+#include "OverviewPyramid.h"
+#include <QAtomicInt>
+#include <QMutex>
+#include <QThreadPool>
 
 using namespace std;
 
@@ -17,29 +22,49 @@ class RepeatOverviewDisplay : public NucleotideDisplay
 public:
 
     RepeatOverviewDisplay(UiVariables*, GLWidget* gl);
+    ~RepeatOverviewDisplay();
     void checkVariables();
     void calculateOutputPixels();
     void display();
     int width();
     void displayLegend(float canvasWidth, float canvasHeight);
     color alignment_color(int score, int frequency);
+    color alignment_color(int score, int frequency, int sampleLength);
+    double offsetHue(double frequency);
+    vector<int> legendValues();
+    QPixmap legendLabel(int value);
     color interpolate(color p1, color p3, double progress);
 
-    /** Optimized Long Int Accessors*/
-    long int& accessLI(int index);
-    long int sequenceLI(int index);
-    int countMatches(long int bits);
-
     /** Optimized Packed Sequence Methods*/
-    int countMatchesShort(unsigned short int bits);
-    int countMatchesChar(unsigned char bits);
-    void calcMatchTable();
-    void normalPack(const string* seq);
-    void shiftMask(char* str, int size);
-    void shiftString(unsigned char* str, int size);
+    void packSequence();
     color simpleAlignment(int index);
     pair<int,int> getBestAlignment(int index);
+    pair<int,int> getBestAlignment(int index, int sampleLength);
+    typedef pair<int,int> (RepeatOverviewDisplay::*AlignmentKernel)(int index, int sampleLength);
+    AlignmentKernel alignmentKernel(int sampleLength);
+    template<int Length>
+    pair<int,int> fixedAlignment(int index, int sampleLength);
+    pair<int,int> genericAlignment(int index, int sampleLength);
+#ifdef PACKED_POPCNT_KERNEL
+    template<int Length>
+    POPCNT_TARGET pair<int,int> fixedAlignmentPopcnt(int index, int sampleLength);
+    POPCNT_TARGET pair<int,int> genericAlignmentPopcnt(int index, int sampleLength);
+#endif
     void setSequence(const string* seq);
+    void stopBackgroundWork();
+    QScrollArea* settingsUi();
+
+    /** Threaded calculation */
+    void alignmentRange(int& start, int& end);
+    void startAlignmentJob(int start, int end, int scale);
+    void cancelAlignmentJob();
+    void alignmentWorker(int generation);
+    void estimatePixels(int start, int scale, vector<color>& pixels);
+
+    /** Precomputed zoomed out views */
+    void startPyramid();
+    bool usingPyramid();
+    void pyramidPixels(int start, int end);
 
     /** Mouse Click methods */
     string SELECT_StringFromMouseClick(int index);
@@ -47,61 +72,42 @@ public:
     int getRelativeIndexFromMouseClick(point2D pt);
 
 public slots:
-    void changeScale(int s);
-    void toggleVisibility();
+    void changeScanRange(int range);
+
+private slots:
+    void refreshAlignmentJob(int generation);
+    void finishAlignmentJob(int generation);
 
 protected:
     int internalScale;
 
 private:	
-    unsigned int charPerIndex;
-    int* countTable;
-    int* countTableShort;
-    int* countTableChar;
-    unsigned char* packSeq;
-    int pSeqSize;
+    PackedSequence packed;
+    bool packedIsCurrent;
     int legendWidth;
+    int scanRange;//offsets 1 to scanRange-1 are compared
+
+    int jobStart;
+    int jobEnd;
+    int jobScale;
+    AlignmentKernel jobKernel;//picked once per job from jobScale
+    int jobBlockSize;//pixels per block
+    int jobBlockCount;
+    int jobPixelCount;//jobPixels never changes size while a job runs
+    int jobGeneration;
+    bool jobRunning;
+    volatile bool jobCancelled;
+    QAtomicInt nextBlock;
+    QAtomicInt activeWorkers;
+    vector<color> jobPixels;//starts as the estimate, workers copy finished blocks in.  storeDisplay() pads what it gets, so it only gets copies
+    QMutex jobPixelsLock;
+    QAtomicInt refreshPending;
+    QThreadPool alignmentPool;//its own threads, so the background index builds on the global pool never hold it up
+
+    OverviewPyramid pyramid;
 
     GLuint display_object;
-    GLWidget* glWidget;
-
 };
 
-inline
-long int& RepeatOverviewDisplay::accessLI(int index)
-{
-    unsigned char* ptr = &(packSeq[pSeqSize - index - sizeof(long int)]);
-    return  *( (long int*)(ptr) );
-}
-
-inline
-long int RepeatOverviewDisplay::sequenceLI(int index)
-{
-    int sub_index = index % charPerIndex;
-    index /= charPerIndex;
-
-    long int start = accessLI(index);
-    if(sub_index)//skip all the shifting if we don't have to do it
-    {
-        int inc = sub_index * 2;
-        start = start << inc;
-        unsigned long int end = accessLI(index + sizeof(long int) );//sign bit has a bad tendency to get duplicated
-        end = end >> (32 - inc);
-        start += end;
-    }
-    return start;
-}
-
-inline
-int RepeatOverviewDisplay::countMatches(long int bits)
-{
-    //TODO: can I do this by pointer casting?
-    int c = countTable[ (unsigned short int)bits ];
-    unsigned short int b = bits >> 16;
-    c += countTable[ b ];
-
-    return c;
-}
-
 
 #endif
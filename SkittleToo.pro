@@ -41,7 +41,20 @@ HEADERS += AbstractGraph.h \
            UiVariables.h \ 
     BiasDisplay.h \
     UtilDrawBar.h \
-    SkittleUtil.h
+    SkittleUtil.h \
+    FftCorrelator.h \
+    PeriodicityTrack.h \
+    PackedSequence.h \
+    TandemPeriodFinder.h \
+    OverviewPyramid.h \
+    KmerIndex.h \
+    MyersMatcher.h \
+    AhoCorasick.h \
+    PackedQueryScanner.h \
+    HitDensityTrack.h \
+    FmIndex.h \
+    StripedAligner.h \
+    RegexDfa.h
 SOURCES += AbstractGraph.cpp \
            RepeatOverviewDisplay.cpp \
            AnnotationDisplay.cpp \
@@ -63,4 +76,17 @@ SOURCES += AbstractGraph.cpp \
            UiVariables.cpp \
            ViewManager.cpp \
     BiasDisplay.cpp \
-    UtilDrawBar.cpp
+    UtilDrawBar.cpp \
+    FftCorrelator.cpp \
+    PeriodicityTrack.cpp \
+    PackedSequence.cpp \
+    TandemPeriodFinder.cpp \
+    OverviewPyramid.cpp \
+    KmerIndex.cpp \
+    MyersMatcher.cpp \
+    AhoCorasick.cpp \
+    PackedQueryScanner.cpp \
+    HitDensityTrack.cpp \
+    FmIndex.cpp \
+    StripedAligner.cpp \
+    RegexDfa.cpp
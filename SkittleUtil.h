@@ -3,6 +3,7 @@
 
 #include "UtilDrawBar.h"
 #include <string>
+#include <QtGlobal>
 using std::string;
 using std::vector;
 
@@ -44,6 +45,59 @@ inline char complement(char n)
     return 'N';//handles up to 8-mer correctly
 }
 
+/** The bases an IUPAC nucleotide code stands for, one bit each: A=1, C=2, G=4, T=8.
+  0 for anything that isn't a code. */
+inline int iupacMask(char n)
+{
+    switch(n)
+    {
+    case 'A': return 1;
+    case 'C': return 2;
+    case 'G': return 4;
+    case 'T': return 8;
+    case 'R': return 1|4;//puRine
+    case 'Y': return 2|8;//pYrimidine
+    case 'S': return 2|4;//Strong
+    case 'W': return 1|8;//Weak
+    case 'K': return 4|8;//Keto
+    case 'M': return 1|2;//aMino
+    case 'B': return 2|4|8;//not A
+    case 'D': return 1|4|8;//not C
+    case 'H': return 1|2|8;//not G
+    case 'V': return 1|2|4;//not T
+    case 'N': return 1|2|4|8;
+    default: return 0;
+    }
+}
+
+/** True if base, an A, C, G or T in the sequence, is one of the bases code allows.
+  N and other letters in the sequence match nothing. */
+inline bool iupacMatches(char code, char base)
+{
+    int b = olig_num(base);
+    return b >= 0 && (iupacMask(code) & (1 << b)) != 0;
+}
+
+/** FNV-1a over the size and every 4093rd nucleotide, for the header of the files that
+  cache work on a sequence.  Enough to notice a different or edited file without
+  reading all of it. */
+inline quint32 sidecarChecksum(const string& sequence)
+{
+    quint32 hash = 2166136261u;
+    quint32 size = sequence.size();
+    for(int i = 0; i < 4; ++i)
+    {
+        hash ^= (size >> (8 * i)) & 0xff;
+        hash *= 16777619u;
+    }
+    for(int i = 0; i < (int)sequence.size(); i += 4093)
+    {
+        hash ^= (unsigned char)sequence[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
 inline vector<int> countNucleotides(const char* genome, int start, int stop)
 {
     vector<int> counts(5,0);
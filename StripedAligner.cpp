@@ -0,0 +1,158 @@
+#include "StripedAligner.h"
+#include "SkittleUtil.h"
+#include <algorithm>
+
+#if defined(__SSE2__)
+#define STRIPED_SSE2
+#include <emmintrin.h>
+#endif
+
+/** ***************************************
+StripedAligner is the "Local Alignment" mode of the Sequence Highlighter, for long
+queries such as a 300bp Alu consensus.  A copy of a repeat family member differs from
+the consensus by scattered indels as well as substitutions, so a gapless percent
+identity falls apart after the first indel.  This scores each end position by its best
+Smith-Waterman local alignment instead: +2 for a match, -3 for a mismatch, and -5 to
+open a gap plus -2 for each nucleotide after the first.
+
+The SSE2 version is Farrar's striped algorithm ("Striped Smith-Waterman speeds database
+searches six times over other SIMD implementations", 2007).  Query row i + k*segments
+goes in lane k of vector i, so the 8 lanes of a vector never depend on each other
+within a column.  Vertical gaps that cross from one lane into the next are fixed up
+afterwards by the "lazy F" loop, which usually stops after a vector or two.  The query
+profile holds the scores of every row against each text letter, striped the same way,
+so the inner loop is one load per vector rather than a lookup per row.
+
+Lanes are 16 bit and saturate, which is enough for queries up to 16000 nucleotides;
+longer ones, and CPUs without SSE2, use the plain dynamic programming loop.
+*******************************************/
+
+static const short negative = -30000;//minus infinity that saturating arithmetic can't wrap
+static const short paddingScore = -10000;//rows past the end of the query never score
+
+StripedAligner::StripedAligner(const string& q)
+    :query(q)
+{
+    segments = max(1, ((int)query.size() + lanes - 1) / lanes);
+    profile.assign(5 * segments * lanes, paddingScore);
+    for(int letter = 0; letter < 5; ++letter)
+    {
+        for(int i = 0; i < segments; ++i)
+        {
+            for(int k = 0; k < lanes; ++k)
+            {
+                int row = i + k * segments;
+                if(row >= (int)query.size())
+                    continue;
+                bool match = letter < 4 && iupacMatches(query[row], num_olig(letter));
+                profile[(letter * segments + i) * lanes + k] = match ? matchScore : -mismatchPenalty;
+            }
+        }
+    }
+}
+
+/** scores[j] is the best score of a local alignment of part of the query that ends at
+  text[j]. */
+void StripedAligner::search(const char* text, int length, vector<int>& scores)
+{
+    scores.assign(max(0, length), 0);
+    if(query.empty())
+        return;
+#ifdef STRIPED_SSE2
+    if((int)query.size() * matchScore > 32000)
+    {
+        searchScalar(text, length, scores);
+        return;
+    }
+    int cells = segments * lanes;
+    vector<short> firstH(cells, 0);
+    vector<short> secondH(cells, 0);
+    vector<short> gapE(cells, negative);
+    short* storeH = &firstH[0];
+    short* loadH = &secondH[0];
+    short* e = &gapE[0];
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i open = _mm_set1_epi16(gapOpen);
+    const __m128i extend = _mm_set1_epi16(gapExtend);
+    const __m128i firstLane = _mm_set_epi16(0, 0, 0, 0, 0, 0, 0, negative);
+
+    for(int j = 0; j < length; ++j)
+    {
+        const short* column = &profile[ACGT_num(text[j]) * cells];
+        __m128i vF = _mm_set1_epi16(negative);
+        __m128i vMax = zero;
+        //the diagonal into row k*segments is the last row of lane k-1
+        __m128i vH = _mm_slli_si128(_mm_loadu_si128((const __m128i*)(storeH + cells - lanes)), 2);
+        std::swap(storeH, loadH);
+        for(int i = 0; i < segments; ++i)
+        {
+            vH = _mm_adds_epi16(vH, _mm_loadu_si128((const __m128i*)(column + i * lanes)));
+            __m128i vE = _mm_loadu_si128((const __m128i*)(e + i * lanes));
+            vH = _mm_max_epi16(vH, vE);
+            vH = _mm_max_epi16(vH, vF);
+            vH = _mm_max_epi16(vH, zero);
+            vMax = _mm_max_epi16(vMax, vH);
+            _mm_storeu_si128((__m128i*)(storeH + i * lanes), vH);
+
+            __m128i vGap = _mm_subs_epi16(vH, open);
+            _mm_storeu_si128((__m128i*)(e + i * lanes), _mm_max_epi16(_mm_subs_epi16(vE, extend), vGap));
+            vF = _mm_max_epi16(_mm_subs_epi16(vF, extend), vGap);
+            vH = _mm_loadu_si128((const __m128i*)(loadH + i * lanes));
+        }
+
+        //lazy F: carry vertical gaps across lanes until they can't raise any H
+        vF = _mm_or_si128(_mm_slli_si128(vF, 2), firstLane);
+        int i = 0;
+        while(true)
+        {
+            vH = _mm_loadu_si128((const __m128i*)(storeH + i * lanes));
+            if(_mm_movemask_epi8(_mm_cmpgt_epi16(vF, _mm_subs_epi16(vH, open))) == 0)
+                break;
+            vH = _mm_max_epi16(vH, vF);
+            vMax = _mm_max_epi16(vMax, vH);
+            _mm_storeu_si128((__m128i*)(storeH + i * lanes), vH);
+            __m128i vE = _mm_loadu_si128((const __m128i*)(e + i * lanes));
+            _mm_storeu_si128((__m128i*)(e + i * lanes), _mm_max_epi16(vE, _mm_subs_epi16(vH, open)));
+            vF = _mm_subs_epi16(vF, extend);
+            if(++i == segments)
+            {
+                vF = _mm_or_si128(_mm_slli_si128(vF, 2), firstLane);
+                i = 0;
+            }
+        }
+
+        vMax = _mm_max_epi16(vMax, _mm_srli_si128(vMax, 8));
+        vMax = _mm_max_epi16(vMax, _mm_srli_si128(vMax, 4));
+        vMax = _mm_max_epi16(vMax, _mm_srli_si128(vMax, 2));
+        scores[j] = (short)_mm_extract_epi16(vMax, 0);
+    }
+#else
+    searchScalar(text, length, scores);
+#endif
+}
+
+/** The same scores one row at a time (Gotoh's affine gap recurrence). */
+void StripedAligner::searchScalar(const char* text, int length, vector<int>& scores)
+{
+    int rows = query.size();
+    vector<int> H(rows, 0);
+    vector<int> E(rows, negative);
+    for(int j = 0; j < length; ++j)
+    {
+        const short* column = &profile[ACGT_num(text[j]) * segments * lanes];
+        int diagonal = 0;
+        int F = negative;
+        int best = 0;
+        for(int i = 0; i < rows; ++i)
+        {
+            int h = diagonal + column[(i % segments) * lanes + i / segments];
+            h = max(max(h, E[i]), max(F, 0));
+            diagonal = H[i];
+            H[i] = h;
+            E[i] = max(E[i] - gapExtend, h - gapOpen);
+            F = max(F - gapExtend, h - gapOpen);
+            best = max(best, h);
+        }
+        scores[j] = best;
+    }
+}
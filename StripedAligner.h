@@ -0,0 +1,34 @@
+#ifndef STRIPED_ALIGNER
+#define STRIPED_ALIGNER
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+*  Smith-Waterman local alignment of one query against every position of a text, with
+*  affine gaps.  On SSE2 the query is striped across 8 lanes of 16 bits, so each text
+*  nucleotide updates 8 rows of the table per instruction.
+*/
+class StripedAligner
+{
+public:
+    StripedAligner(const string& query);
+    void search(const char* text, int length, vector<int>& scores);
+
+    static const int matchScore = 2;
+    static const int mismatchPenalty = 3;
+    static const int gapOpen = 5;//first nucleotide of a gap
+    static const int gapExtend = 2;//each one after that
+    static const int lanes = 8;
+
+private:
+    void searchScalar(const char* text, int length, vector<int>& scores);
+
+    string query;
+    int segments;//rows per lane
+    vector<short> profile;//for each text letter, segments vectors of lanes scores
+};
+
+#endif
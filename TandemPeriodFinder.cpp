@@ -0,0 +1,103 @@
+#include "TandemPeriodFinder.h"
+#include <algorithm>
+
+/** ***************************************
+TandemPeriodFinder answers "what width should I use here?" for the SELECT tool.
+It packs a window of sequence around the clicked index into a PackedSequence and
+scores every offset p from 1 to maxPeriod by the fraction of nucleotides that match
+the one p further along.  This is the same score RepeatMap shows in one row, but it
+only needs 32 nucleotides per XOR, so a 500 offset query takes well under 10ms.
+
+A tandem repeat scores high at its period and at every multiple of it.  Peaks are
+ranked by score and a peak is reported as the smallest period that divides it and
+scores nearly as well, so a 171bp repeat reports 171 and not 342.
+*******************************************/
+
+static const float harmonicTolerance = 0.05;
+
+struct ByScore
+{
+    const vector<float>* scores;
+    bool operator()(int a, int b) const
+    {
+        if((*scores)[a] != (*scores)[b])
+            return (*scores)[a] > (*scores)[b];
+        return a < b;//prefer the shorter period on ties
+    }
+};
+
+TandemPeriodFinder::TandemPeriodFinder()
+{
+}
+
+/** Returns up to count periods, best first.  index is in the coordinates of seq, which
+  starts with a pad character. */
+vector<PeriodEstimate> TandemPeriodFinder::estimate(const string& seq, int index, int maxPeriod, int count)
+{
+    vector<PeriodEstimate> results;
+    maxPeriod = max(1, maxPeriod);
+    int windowLength = max(2 * maxPeriod, 200);
+    int begin = max(1, index - windowLength / 2);
+    int end = min((int)seq.size(), begin + windowLength + maxPeriod);
+    if(end - begin < 2)
+        return results;
+    packed.pack(seq.c_str() + begin, end - begin);
+
+    scores.assign(maxPeriod + 2, 0.0);
+    for(int p = 1; p <= maxPeriod; ++p)
+    {
+        int length = min(windowLength, packed.size() - p);
+        if(length < 1)
+            break;
+        scores[p] = float(packed.matches(0, p, length)) / length;
+    }
+
+    vector<int> peaks = localPeaks();
+    for(int i = 0; i < (int)peaks.size() && (int)results.size() < count; ++i)
+    {
+        int period = peaks[i];
+        for(int j = 0; j < (int)peaks.size(); ++j)
+        {
+            int divisor = peaks[j];
+            if(divisor < period && peaks[i] % divisor == 0
+                    && scores[divisor] >= scores[peaks[i]] - harmonicTolerance)
+                period = divisor;
+        }
+
+        bool duplicate = false;
+        for(int k = 0; k < (int)results.size(); ++k)
+            if(results[k].period == period)
+                duplicate = true;
+        if(duplicate)
+            continue;
+
+        PeriodEstimate estimate;
+        estimate.period = period;
+        estimate.score = scores[period];
+        results.push_back(estimate);
+    }
+    return results;
+}
+
+/** Offsets that score at least as well as both neighbors and better than average,
+  sorted best first. */
+vector<int> TandemPeriodFinder::localPeaks()
+{
+    int last = (int)scores.size() - 2;
+    double mean = 0.0;
+    for(int p = 1; p <= last; ++p)
+        mean += scores[p];
+    mean /= max(1, last);
+
+    vector<int> peaks;
+    for(int p = 1; p <= last; ++p)
+    {
+        bool leftOk = (p == 1) || scores[p] >= scores[p-1];
+        if(leftOk && scores[p] >= scores[p+1] && scores[p] > mean)
+            peaks.push_back(p);
+    }
+    ByScore order;
+    order.scores = &scores;
+    sort(peaks.begin(), peaks.end(), order);
+    return peaks;
+}
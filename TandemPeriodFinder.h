@@ -0,0 +1,33 @@
+#ifndef TANDEM_PERIOD_FINDER
+#define TANDEM_PERIOD_FINDER
+
+#include <string>
+#include <vector>
+#include "PackedSequence.h"
+
+using namespace std;
+
+struct PeriodEstimate
+{
+    int period;
+    float score;//fraction of nucleotides that match one period further along
+};
+
+/**
+*  Estimates the monomer length of a tandem repeat around an index by autocorrelating
+*  the nearby sequence against itself at every offset from 1 to maxPeriod.
+*/
+class TandemPeriodFinder
+{
+public:
+    TandemPeriodFinder();
+    vector<PeriodEstimate> estimate(const string& seq, int index, int maxPeriod = 500, int count = 5);
+
+private:
+    vector<int> localPeaks();
+
+    PackedSequence packed;
+    vector<float> scores;//scores[p] for offset p
+};
+
+#endif
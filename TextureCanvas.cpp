@@ -18,6 +18,11 @@ display surface into multiple textureTile if the area is wider than the maximum
 texture size( stored in vector< vector< textureTile > > canvas).  All the data
 passed from the Graph class owner is stored in vector<color> colors and is passed
 in through the constructor.  This means a new TextureCanvas is generated every frame.
+
+A graph whose view moves by whole lines can instead call scrollRows() and then
+replaceRows() for the lines that came into view.  The top rows of the texture are then
+treated as a ring: nothing already on the card is moved, the rows are just drawn from a
+different starting row, and only the new lines are uploaded.
 ********************************************/
 
 TextureCanvas::TextureCanvas()
@@ -55,6 +60,8 @@ TextureCanvas::~TextureCanvas()
 void TextureCanvas::init(int w, bool raggedEdge)
 {
     ragged = raggedEdge;
+    ringRows = 0;
+    rowOffset = 0;
     max_size = checkForDisplayDriver();
     width = max(1, w);//don't divide by zero
 }
@@ -145,6 +152,50 @@ void TextureCanvas::display()
     }
 }
 
+/** Moves the first rows lines of the canvas up by lines (down if negative), wrapping
+  around.  The rows that wrap keep their old pixels until replaceRows() is called for
+  them.  Returns false, and changes nothing, if the canvas can't do that without being
+  rebuilt: it has no textures, or isn't a ring of the same number of rows. */
+bool TextureCanvas::scrollRows(int lines, int rows)
+{
+    if(!useTextures || rows < 1 || rows >= height || (ringRows != 0 && ringRows != rows))
+        return false;
+    ringRows = rows;
+    rowOffset = ((rowOffset + lines) % rows + rows) % rows;
+    return true;
+}
+
+/** Uploads count rows of width pixels to screen rows [firstRow, firstRow+count), into
+  whichever texture rows those are drawn from. */
+void TextureCanvas::replaceRows(const color* pixels, int firstRow, int count)
+{
+    if(!useTextures)
+        return;
+    vector<unsigned char> data;
+    for(int h = firstRow; h < firstRow + count && h < height; ++h)
+    {
+        int row = h < ringRows ? (h + rowOffset) % ringRows : h;
+        const color* line = pixels + (h - firstRow) * width;
+        for(int x = 0; x < (int)canvas.size(); ++x)
+        {
+            int y = row / max_size;
+            if(y >= (int)canvas[x].size())
+                continue;
+            textureTile& tile = canvas[x][y];
+            data.clear();
+            for(int i = x * max_size; i < x * max_size + tile.width; ++i)
+            {
+                data.push_back(line[i].r);
+                data.push_back(line[i].g);
+                data.push_back(line[i].b);
+            }
+            glBindTexture (GL_TEXTURE_2D, tile.tex_id);
+            glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
+            glTexSubImage2D (GL_TEXTURE_2D, 0, 0, row % max_size, tile.width, 1, GL_RGB, GL_UNSIGNED_BYTE, &data[0]);
+        }
+    }
+}
+
 void TextureCanvas::createDisplayList()
 {
     displayList = glGenLists(1);
@@ -161,32 +212,49 @@ void TextureCanvas::drawTextureSquare()//draws from canvas
     for(unsigned int x =0; x < canvas.size(); ++x)
     {
         for(unsigned int y = 0; y < canvas[x].size(); ++y)
-        {
+        {//a tile is cut where the ring wraps and where it ends
             textureTile& tile = canvas[x][y];
-            glPushMatrix();
-            glTranslated(x * max_size, y*max_size, 0);
-            glColor3d(1.0,1.0,1.0);
-            glEnable (GL_TEXTURE_2D); /* enable texture mapping */
-            glBindTexture (GL_TEXTURE_2D, tile.tex_id); /* bind to our texture, has id of 13 */
-
-            glBegin (GL_QUADS);
-            glTexCoord2f (0.0f,0.0f); /* upper left corner of image */
-            glVertex3f (0.0f, 0.0f, 0.0f);
-            glTexCoord2f (1.0f, 0.0f); /* upper right corner of image */
-            glVertex3f (tile.width, 0.0f, 0.0f);
-            glTexCoord2f (1.0f, 1.0f); /* lower right corner of image */
-            glVertex3f (tile.width, tile.height, 0.0f);
-            glTexCoord2f (0.0f, 1.0f); /* lower left corner of image */
-            glVertex3f (0.0f, tile.height, 0.0f);
-            glEnd ();
-
-            glDisable (GL_TEXTURE_2D); /* disable texture mapping */
-            glPopMatrix();
+            int top = y * max_size;
+            int bottom = top + tile.height;
+            int cuts[4] = { top, max(top, min(bottom, rowOffset)), max(top, min(bottom, ringRows)), bottom };
+            for(int i = 0; i < 3; ++i)
+            {
+                if(cuts[i] >= cuts[i+1])
+                    continue;
+                int screenRow = cuts[i] < ringRows ? (cuts[i] - rowOffset + ringRows) % ringRows : cuts[i];
+                drawTileRows(tile, x * max_size, screenRow, cuts[i] - top, cuts[i+1] - top);
+            }
         }
     }
     glPopMatrix();
 }
 
+/** Draws rows [firstRow, lastRow) of tile with its top left corner at (left, top). */
+void TextureCanvas::drawTileRows(textureTile& tile, int left, int top, int firstRow, int lastRow)
+{
+    float begin = float(firstRow) / tile.height;
+    float end = float(lastRow) / tile.height;
+    glPushMatrix();
+    glTranslated(left, top, 0);
+    glColor3d(1.0,1.0,1.0);
+    glEnable (GL_TEXTURE_2D); /* enable texture mapping */
+    glBindTexture (GL_TEXTURE_2D, tile.tex_id); /* bind to our texture, has id of 13 */
+
+    glBegin (GL_QUADS);
+    glTexCoord2f (0.0f, begin); /* upper left corner of image */
+    glVertex3f (0.0f, 0.0f, 0.0f);
+    glTexCoord2f (1.0f, begin); /* upper right corner of image */
+    glVertex3f (tile.width, 0.0f, 0.0f);
+    glTexCoord2f (1.0f, end); /* lower right corner of image */
+    glVertex3f (tile.width, lastRow - firstRow, 0.0f);
+    glTexCoord2f (0.0f, end); /* lower left corner of image */
+    glVertex3f (0.0f, lastRow - firstRow, 0.0f);
+    glEnd ();
+
+    glDisable (GL_TEXTURE_2D); /* disable texture mapping */
+    glPopMatrix();
+}
+
 GLuint TextureCanvas::loadTexture(textureTile& tile)
 {
     GLuint tex_id;
@@ -31,6 +31,8 @@ public:
     ~TextureCanvas();
     void init(int w = 1, bool raggedEdge = false);
     void display();
+    bool scrollRows(int lines, int rows);
+    void replaceRows(const color* pixels, int firstRow, int count);
     static int const maxSaneWidth = 4000;
     bool ragged;
     int getMaxSize();
@@ -42,6 +44,7 @@ private:
     void createEmptyTiles(int canvas_width, int canvas_height, int max_size);
     void createDisplayList();
     void drawTextureSquare();
+    void drawTileRows(textureTile& tile, int left, int top, int firstRow, int lastRow);
     point2D grid_position(int i, int width, int height, int max_size );
     GLuint loadTexture(textureTile& tile);
 
@@ -53,6 +56,8 @@ private:
     GLuint displayList;
     int width;
     int height;
+    int ringRows;//rows drawn as a ring by scrollRows(), 0 if it was never called
+    int rowOffset;//texture row of the top screen row of the ring
     vector< vector< textureTile > > canvas;
     vector<color> colors;
 };
@@ -60,6 +60,7 @@ void ViewManager::uiToGlwidgetConnections(GLWidget* active)
     connect(mainWindow->zoomAction,          SIGNAL(triggered()), active, SLOT(on_zoomButton_clicked()));
     connect(mainWindow->addAnnotationAction, SIGNAL(triggered()), active, SLOT(on_addAnnotationButton_clicked()));
     connect(mainWindow->zoomExtents,         SIGNAL(clicked()),   active, SLOT(zoomExtents()));
+    connect(mainWindow->snapWidth,           SIGNAL(clicked()),   active, SLOT(snapWidthToPeriod()));
 
     connect( active, SIGNAL(addGraphMode(AbstractGraph*)), mainWindow, SLOT(addDisplayActions(AbstractGraph*)));
     connect( active, SIGNAL(addDivider()), mainWindow, SLOT(addDisplayDivider()));
@@ -176,6 +177,21 @@ void ViewManager::jumpToPrevAnnotation()
     }
 }
 
+void ViewManager::jumpToNextMatch()
+{
+    if(activeWidget != NULL)
+    {
+        activeWidget->jumpToMatch(true);
+    }
+}
+void ViewManager::jumpToPrevMatch()
+{
+    if(activeWidget != NULL)
+    {
+        activeWidget->jumpToMatch(false);
+    }
+}
+
 //PRIVATE FUNCTIONS//
 bool ViewManager::newOffsetDial(GLWidget* gl)
 {
@@ -34,6 +34,8 @@ public slots:
     void addAnnotationDisplay(QString);
     void jumpToNextAnnotation();
     void jumpToPrevAnnotation();
+    void jumpToNextMatch();
+    void jumpToPrevMatch();
     void updateCurrentDisplay();
 
 private:
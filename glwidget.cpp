@@ -185,6 +185,7 @@ const string* GLWidget::seq()
 void GLWidget::displayString(const string* sequence)
 {
     ui->print("New sequence received.  Size:", sequence->size());
+    nearbyPeriods.clear();
 
     for(int i = 0; i < (int)graphs.size(); ++i)
     {
@@ -199,6 +200,17 @@ void GLWidget::zoomExtents()
     zoomRange(1,seq()->size());
 }
 
+/** Sets the width to the best period from the last SELECT click.  Without a click, the
+  repeat at the top of the screen is used. */
+void GLWidget::snapWidthToPeriod()
+{
+    if(nearbyPeriods.empty())
+        reportPeriods(ui->getStart(glWidget) + ui->getWidth() / 2);
+    if(nearbyPeriods.empty())
+        return;
+    ui->setWidth(nearbyPeriods[0].period);
+}
+
 void GLWidget::zoomRange(int startIndex, int endIndex)
 {//TODO:refactor this with pixelToGlCoords
     int newZoom = -1;
@@ -495,6 +507,19 @@ void GLWidget::jumpToAnnotation(bool forward)
         ui->print("There are no annotations further in the file.");
 }
 
+/** Moves the view to the next (or previous) exact match of the Sequence Highlighter's
+  last query, such as the one picked with the FIND tool. */
+void GLWidget::jumpToMatch(bool forward)
+{
+    int position = highlight->findMatch(ui->getStart(glWidget), forward);
+    if(position >= 0)
+        ui->setStart(glWidget, position);
+    else if(forward)
+        ui->print("There are no matches further in the file.");
+    else
+        ui->print("There are no matches earlier in the file.");
+}
+
 AnnotationDisplay* GLWidget::findMatchingAnnotationDisplay(string fileName)
 {
     vector<AnnotationDisplay*> aDisplays = getAllAnnotationDisplays();
@@ -849,6 +874,45 @@ vector<string> GLWidget::mouseOverText(point2D oglCoords)
     return responses;
 }
 
+/** Sequence index under the mouse, taken from whichever Graph is under it.  Falls back
+  to the start of the line if the Graph can't resolve x. */
+int GLWidget::indexUnderCursor(point2D oglCoords)
+{
+    int lineStart = ui->getStart(glWidget) + max(0, oglCoords.y) * ui->getWidth();
+    for(int i = 0; i < (int)graphs.size(); ++i)
+    {
+        if(!graphs[i]->hidden)
+        {
+            if(oglCoords.x >= 0 && oglCoords.x < graphs[i]->width())
+            {
+                int index = graphs[i]->getRelativeIndexFromMouseClick(oglCoords);
+                if(index > -1)
+                    return index + ui->getStart(glWidget);
+                return lineStart;
+            }
+            oglCoords.x -= graphs[i]->width() + border;
+        }
+    }
+    return lineStart;
+}
+
+/** Prints the most likely tandem repeat periods around index and keeps them for the
+  "Snap to Repeat" button. */
+void GLWidget::reportPeriods(int index)
+{
+    if(seq() == NULL || index < 1 || index >= (int)seq()->size())
+        return;
+    nearbyPeriods = periodFinder.estimate(*seq(), index);
+    if(nearbyPeriods.empty())
+        return;
+
+    stringstream ss;
+    ss << "Repeat periods near " << index << ":";
+    for(int i = 0; i < (int)nearbyPeriods.size(); ++i)
+        ss << " " << nearbyPeriods[i].period << "bp (" << (int)(nearbyPeriods[i].score * 100) << "%)";
+    ui->print(ss.str());
+}
+
 void GLWidget::mousePressEvent(QMouseEvent* event)
 {
     parent->mousePressEvent(event);
@@ -866,6 +930,7 @@ void GLWidget::mousePressEvent(QMouseEvent* event)
         {
             for(int i = 0; i < (int)responses.size(); ++i)
                 ui->print(responses[i]);
+            reportPeriods(indexUnderCursor(startPoint));
         }
         if(tool() == FIND_TOOL)
         {
@@ -1234,6 +1299,8 @@ void GLWidget::loadFile(QString fileName)
         parent->setWindowTitle( trimPathFromFilename(fileName.toStdString()).c_str());
 
     removeAllAnnotations();
+    for(int i = 0; i < (int)graphs.size(); ++i)
+        graphs[i]->stopBackgroundWork();
     reader->readFile(fileName);
 }
 
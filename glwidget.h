@@ -29,6 +29,7 @@
 #include "UiVariables.h"
 #include "MdiChildWindow.h"
 #include "SkittleUtil.h"
+#include "TandemPeriodFinder.h"
 
 class UiVariables;
 class FastaReader;
@@ -53,6 +54,7 @@ class GLWidget : public QGLWidget
 public:
     UiVariables* ui;
     string chromosomeName;
+    string sequenceFile;//full path of the open sequence, for sidecar files
     MdiChildWindow* parent;
     FastaReader* reader;
     GtfReader*	trackReader;
@@ -95,6 +97,7 @@ public slots:
     void reportOnFinish(int);
     void displayString(const string* sequence);
     void zoomExtents();
+    void snapWidthToPeriod();
     void zoomRange(int startIndex, int endIndex);
     void on_moveButton_clicked();
     void on_selectButton_clicked();
@@ -109,6 +112,7 @@ public slots:
     void updateDisplay();
     void updateDisplaySize();
     void jumpToAnnotation(bool forward);
+    void jumpToMatch(bool forward);
     AnnotationDisplay* addAnnotationDisplay(QString fileName);
     AnnotationDisplay* findMatchingAnnotationDisplay(string fileName);
     vector<AnnotationDisplay*> getAllAnnotationDisplays();
@@ -143,6 +147,8 @@ protected:
     void resizeGL(int width, int height);
     bool event(QEvent *);
     vector<string> mouseOverText(point2D oglCoords);
+    int indexUnderCursor(point2D oglCoords);
+    void reportPeriods(int index);
     void mousePressEvent(QMouseEvent *event);
     void mouseMoveEvent(QMouseEvent *event);
     void mouseReleaseEvent(QMouseEvent *event);
@@ -173,6 +179,8 @@ private:
     point2D startPoint;
     point2D endPoint;
     QPoint mousePressPosition;
+    TandemPeriodFinder periodFinder;
+    vector<PeriodEstimate> nearbyPeriods;//from the last SELECT click
     QPoint mouseMovePosition;
     QPoint mouseReleasePosition;
 };